@@ -10,6 +10,11 @@
 //  - i.e. convert the node pointers to indices in an (external) object array, then
 //    just write out the nodes array and the free list
 //
+// Node lookup:
+//  - a pointer -> index hash map is kept alongside the nodes array, so that finding
+//    a node's index (in addNode, removeNode, etc.) is O(1)
+//  - define _GT_DISABLE_NODE_INDEX to fall back to a linear scan of the nodes array
+//
 // MIT licensed: http://opensource.org/licenses/MIT
 //
 
@@ -18,12 +23,42 @@
 
 #include <vector>
 #include <cstdio>
+#include <cstdint>
+#include <algorithm>
+#include <functional>
+
+#include <unordered_map>
+
+#include "GenericTree_Binary.h"
+#include "GenericTree_AncestorIndex.h"
 
 // Optionally enable serialization
 #ifdef _GT_ENABLE_SERIALIZATION
   #include "Diatom/Diatom.h"
+  #include "GenericTree_DiatomStream.h"
+#endif
+
+// Optionally allocate node, child list and node index storage from an arena
+#ifdef _GT_ENABLE_ARENA
+  #include "GenericTree_Arena.h"
+#endif
+
+// Optionally count work done on hot paths, returned by stats()
+#ifdef _GT_ENABLE_STATS
+  #include "GenericTree_Stats.h"
+  #define _GT_STAT(x) x
+#else
+  #define _GT_STAT(x)
 #endif
 
+// Optionally define _GT_ENABLE_SUBTREE_INFO to store each node's subtree
+// size and depth, for O(1) subtreeSize() and depth()
+
+// Optionally define _GT_UNORDERED_CHILDREN to keep each node's position in
+// its parent's child list, so that removing a child takes O(1), by moving the
+// parent's last child into its place. Children are then not kept in insertion
+// order. (GenericTree_Linked removes children in O(1) and keeps their order.)
+
 // Optionally disable asserts
 #ifdef _GT_DISABLE_SAFETY_CHECKS
   #define _assert(x)
@@ -38,23 +73,204 @@
 template <class T>
 class GenericTree {
 public:
+#ifdef _GT_ENABLE_ARENA
+  typedef std::vector<int, GenericTree_ArenaAllocator<int>> ChildList;
+#else
+  typedef std::vector<int> ChildList;
+#endif
+
   struct NodeInfo {
     T *node;
     int index_of_parent;
-    std::vector<int> children;
+    ChildList children;
+#ifdef _GT_ENABLE_SUBTREE_INFO
+    int subtree_size;      // Nodes in the subtree at this node, itself included
+    int depth;             // 0 at the top of the tree, or of a detached subtree
+#endif
+#ifdef _GT_UNORDERED_CHILDREN
+    int index_in_parent;   // Position in the parent's child list
+#endif
+  };
+
+#ifdef _GT_ENABLE_ARENA
+  typedef std::vector<NodeInfo, GenericTree_ArenaAllocator<NodeInfo>> NodeList;
+  typedef std::unordered_map<T*, int, std::hash<T*>, std::equal_to<T*>,
+                             GenericTree_ArenaAllocator<std::pair<T* const, int>>> NodeIndex;
+#else
+  typedef std::vector<NodeInfo> NodeList;
+  typedef std::unordered_map<T*, int> NodeIndex;
+#endif
+
+  struct ChildSpan {
+    // A view of a node's child indices, valid until that node's children are
+    // next modified. Converts to std::vector<int> for callers that want a copy.
+    const int *first;
+    const int *last;
+
+    const int* begin() const { return first; }
+    const int* end()   const { return last; }
+    int  size()  const { return int(last - first); }
+    bool empty() const { return first == last; }
+    int  operator[](int k) const { return first[k]; }
+
+    operator std::vector<int>() const { return std::vector<int>(first, last); }
   };
 
   void reset() {
+#ifdef _GT_ENABLE_ARENA
+    // Release the storage, rather than clear(), so none is left in the arena
+    NodeList(GenericTree_ArenaAllocator<NodeInfo>(arena)).swap(nodes);
+#else
     nodes.clear();
+#endif
     free_list.clear();
+    live_slots.clear();
+    i_root = __GT_NOT_FOUND;
+    ancestor_index_stale = true;
+#ifndef _GT_DISABLE_NODE_INDEX
+  #ifdef _GT_ENABLE_ARENA
+    NodeIndex(0, std::hash<T*>(), std::equal_to<T*>(),
+              GenericTree_ArenaAllocator<std::pair<T* const, int>>(arena)).swap(node_index);
+  #else
+    node_index.clear();
+  #endif
+#endif
+  }
+
+  void reserve(size_t n) {
+    nodes.reserve(n);
+    live_slots.reserve((n + 63) >> 6);
+#ifndef _GT_DISABLE_NODE_INDEX
+    node_index.reserve(n);
+#endif
+  }
+
+#ifdef _GT_ENABLE_STATS
+  // Stats
+  // -----------------------------
+  // Counts of work done on hot paths since construction or the last
+  // resetStats() - see GenericTree_Stats.h. reset() doesn't clear them.
+
+  const GenericTree_Stats& stats() {
+    noteFreeListLength();
+    return stat_counts;
+  }
+
+  void resetStats() {
+    stat_counts = GenericTree_Stats();
+  }
+#endif
+
+#ifdef _GT_ENABLE_ARENA
+  // Arena allocation
+  // -----------------------------
+  // With _GT_ENABLE_ARENA defined, the nodes vector, the child lists and the
+  // node index are allocated from the arena set here (or from the heap if none
+  // is set), so that building a tree doesn't allocate per node. See
+  // GenericTree_Arena.h.
+  //  - setArena() resets the tree
+  //  - reset the tree before resetting its arena, as the arena's memory is
+  //    then reused
+
+  void setArena(GenericTree_Arena *_arena) {
+    arena = _arena;
+    reset();
+  }
+#endif
+
+  // Bulk construction
+  // -----------------------------
+  // Build the tree from n node pointers and a matching array of parent indices,
+  // where parent[i] is the index of items[i]'s parent, or -1 for the root.
+  // Node i gets index i, and children are ordered by index.
+  //  - builds all child lists in two linear passes (count, then fill)
+  //  - fails, leaving the tree empty, unless there is exactly one root, every
+  //    node is reachable from it, and no pointer appears twice
+
+  bool buildFromParentArray(T **items, const int *parent, size_t n) {
+    reset();
+    if (n == 0) {
+      return true;
+    }
+
+    // Pass 1: validate parents & count children
+    std::vector<int> n_children(n, 0);
+    int i_top = __GT_NOT_FOUND;
+
+    for (int i=0; i < int(n); ++i) {
+      int p = parent[i];
+      if (p == __GT_NOT_FOUND) {
+        if (i_top != __GT_NOT_FOUND) {
+          return false;    // More than one root
+        }
+        i_top = i;
+      }
+      else if (p < 0 || p >= int(n) || p == i) {
+        return false;
+      }
+      else {
+        ++n_children[p];
+      }
+    }
+    if (i_top == __GT_NOT_FOUND) {
+      return false;
+    }
+
+    // No pointer may appear twice. Checked on a sorted copy, so that it holds
+    // whether or not the tree has a node index.
+    {
+      std::vector<T*> sorted(items, items + n);
+      std::sort(sorted.begin(), sorted.end(), std::less<T*>());
+      if (std::adjacent_find(sorted.begin(), sorted.end()) != sorted.end()) {
+        return false;
+      }
+    }
+
+    // Pass 2: fill
+    nodes.resize(n, blankNode(NULL));
+    for (int i=0; i < int(n); ++i) {
+      nodes[i].node            = items[i];
+      nodes[i].index_of_parent = parent[i];
+      nodes[i].children.reserve(n_children[i]);
+#ifndef _GT_DISABLE_NODE_INDEX
+      node_index[items[i]] = i;
+#endif
+    }
+    for (int i=0; i < int(n); ++i) {
+      if (parent[i] != __GT_NOT_FOUND) {
+        nodes[parent[i]].children.push_back(i);
+      }
+    }
+
+    rebuildLiveSlots();
+    indexAllChildPositions();
+    rebuildSubtreeInfo();
+    i_root = i_top;
+
+    // Every node must be reachable from the root, otherwise the parent array
+    // contains a cycle
+    int n_reached = 0;
+    traversePreorder(i_top, [&](int i, int depth) { ++n_reached; });
+    if (n_reached != int(n)) {
+      reset();
+      return false;
+    }
+
+    return true;
+  }
+
+  static GenericTree<T> fromParentArray(T **items, const int *parent, size_t n) {
+    GenericTree<T> t;
+    bool ok = t.buildFromParentArray(items, parent, n);
+    _assert(ok);
+    return t;
   }
 
   int addNode(T &x, T *parent) {
     _assert(!nodeIsPresent(x));
-    NodeInfo node = { &x, __GT_NOT_FOUND };
+    NodeInfo node = blankNode(&x);
 
-    bool was_empty = isEmpty();
-    int i__prev_top = was_empty ? __GT_NOT_FOUND : indexOfTopNode();
+    int i__prev_top = i_root;
 
     if (parent) {
       node.index_of_parent = indexOfNode(*parent);
@@ -68,6 +284,7 @@ public:
     if (free_list.size() > 0) {
       ind = free_list.back();
       free_list.pop_back();
+      _GT_STAT(++stat_counts.free_list_reuses);
       _assert(ind < nodes.size());
       nodes[ind] = node;
     }
@@ -77,16 +294,26 @@ public:
       ind = int(nodes.size()) - 1;
     }
 
+    setSlotLive(ind, true);
+#ifndef _GT_DISABLE_NODE_INDEX
+    node_index[&x] = ind;
+#endif
+    subtreeInfo_Add(ind, node.index_of_parent, i__prev_top);
+    ancestor_index_stale = true;
+
     // Add node to parent's children array
     if (parent) {
-      nodes[node.index_of_parent].children.push_back(ind);
+      appendChild(node.index_of_parent, ind);
     }
 
     // If the node is being inserted at the top, deal with current
     // top node (if present)
-    else if (!was_empty) {
-      nodes[ind].children.push_back(i__prev_top);
-      nodes[i__prev_top].index_of_parent = ind;
+    else {
+      if (i__prev_top != __GT_NOT_FOUND) {
+        appendChild(ind, i__prev_top);
+        nodes[i__prev_top].index_of_parent = ind;
+      }
+      i_root = ind;
     }
 
     return ind;
@@ -96,25 +323,71 @@ public:
     int i = indexOfNode(x);
     _assert(i != __GT_NOT_FOUND);
 
+    subtreeInfo_Detach(i);
+    if (!recursivelyRemoveChildren) {
+      subtreeInfo_Orphan(i);
+    }
+
     NodeInfo &node = nodes[i];
     free_list.push_back(i);
+    setSlotLive(i, false);
+    _GT_STAT(noteFreeListLength());
+    ancestor_index_stale = true;
+#ifndef _GT_DISABLE_NODE_INDEX
+    node_index.erase(node.node);
+#endif
 
+    // An orphan's old parent slot may have been freed, or reused by a node
+    // which doesn't list it
     int parent_ind = node.index_of_parent;
-    if (parent_ind != __GT_NOT_FOUND) {
+    if (parent_ind != __GT_NOT_FOUND && slotIsLive(parent_ind) && nodeListsChild(parent_ind, i)) {
       removeChild_ForNodeAtIndex(parent_ind, i);
     }
+    if (i == i_root) {
+      i_root = __GT_NOT_FOUND;
+    }
 
     if (recursivelyRemoveChildren)
       removeChildren(i);
   }
 
+  bool moveSubtree(T &x, T &new_parent, int position = -1) {
+    // Make x the child of new_parent at position (after x is removed from its
+    // old parent), or its last child if -1, taking its subtree with it. Only
+    // the two child lists change, so the cost doesn't depend on the size of the
+    // subtree. Fails if new_parent is in x's subtree, or if x is the top node,
+    // as then new_parent could only be in an orphaned subtree.
+    int i = indexOfNode(x);
+    int i_new_parent = indexOfNode(new_parent);
+    _assert(i != __GT_NOT_FOUND && i_new_parent != __GT_NOT_FOUND);
+
+    if (i == i_root || subtreeContains(i, i_new_parent)) {
+      return false;
+    }
+
+    subtreeInfo_Detach(i);
+
+    // An orphan's old parent slot may have been freed, or reused by a node
+    // which doesn't list it
+    int old_parent = nodes[i].index_of_parent;
+    if (old_parent != __GT_NOT_FOUND && slotIsLive(old_parent) && nodeListsChild(old_parent, i)) {
+      removeChild_ForNodeAtIndex(old_parent, i);
+    }
+
+    insertChild(i_new_parent, i, position);
+    nodes[i].index_of_parent = i_new_parent;
+    subtreeInfo_Attach(i);
+    ancestor_index_stale = true;
+    return true;
+  }
+
   void print() {
     int i_top = indexOfTopNode();
     if (i_top == __GT_NOT_FOUND) {
       printf("[Tree is empty]\n");
     }
     else {
-      recursivelyPrintNode(i_top);
+      printSubtree(i_top);
     }
 
     size_t n_fl = free_list.size();
@@ -137,29 +410,40 @@ public:
       return;
     }
 
-    auto &n = nodes[i];
+    traversePreorder(i, [&](int j, int depth) { f(nodes[j].node, j); });
+  }
+    // walk:           parents before children
+    // walk_postorder: children before parents
+    // walk_levelorder: breadth-first, level by level
 
-    f(n.node, i);
-    for (auto &i : n.children) {
-      walk(f, i);
+  template <class Functor>
+  void walk_postorder(Functor f, int i = -2) {
+    if (i == -2) {
+      i = indexOfTopNode();
     }
-  }
 
-  int indexOfTopNode() {
-    if (isEmpty()) {
-      return __GT_NOT_FOUND;
+    if (i == __GT_NOT_FOUND) {
+      return;
     }
 
-    int i_top = 0;
-    while (indexIsInFreeList(i_top)) {
-      ++i_top;
+    traversePostorder(i, [&](int j, int depth) { f(nodes[j].node, j); });
+  }
+
+  template <class Functor>
+  void walk_levelorder(Functor f, int i = -2) {
+    if (i == -2) {
+      i = indexOfTopNode();
     }
 
-    while (nodes[i_top].index_of_parent != __GT_NOT_FOUND) {
-      i_top = nodes[i_top].index_of_parent;
+    if (i == __GT_NOT_FOUND) {
+      return;
     }
 
-    return i_top;
+    traverseLevelorder(i, [&](int j, int depth) { f(nodes[j].node, j); });
+  }
+
+  int indexOfTopNode() {
+    return i_root;
   }
 
   int parentOfNode(int i) {
@@ -171,9 +455,10 @@ public:
     _assert(node_i < nodes.size());
     return (int) nodes[node_i].children.size();
   }
-  std::vector<int> children(int node_i) {
-    assert(node_i < nodes.size());
-    return nodes[node_i].children;
+  ChildSpan children(int node_i) {
+    _assert(node_i < nodes.size());
+    const ChildList &ch = nodes[node_i].children;
+    return { ch.data(), ch.data() + ch.size() };
   }
 
   int childOfNode(int node_i, int child_i) {
@@ -191,86 +476,731 @@ public:
     return (nodes.size() == free_list.size());
   }
 
+#ifdef _GT_ENABLE_SUBTREE_INFO
+  // Subtree sizes & depths
+  // -----------------------------
+  // Kept up to date as the tree changes, so both are read in O(1):
+  //  - adding or removing a node updates its ancestors' sizes, in O(depth)
+  //  - adding a node at the top, or removing one non-recursively, also updates
+  //    depths, in O(size) of the subtrees affected
+  //  - the children of a node removed non-recursively become the tops of
+  //    detached subtrees, at depth 0, and are counted in no ancestor's size
+
+  int subtreeSize(int i) {
+    // Including i itself
+    _assert(i >= 0 && i < nodes.size() && slotIsLive(i));
+    return nodes[i].subtree_size;
+  }
+
+  int depth(int i) {
+    _assert(i >= 0 && i < nodes.size() && slotIsLive(i));
+    return nodes[i].depth;
+  }
+#endif
+
+  // Ancestor index
+  // -----------------------------
+  // Numbers the nodes of the tree in pre-order (see GenericTree_AncestorIndex.h),
+  // so that these are O(1) rather than climbs or walks. The index is built by
+  // buildAncestorIndex(), or by the first query after the tree has changed:
+  // call it first when querying from several threads. Nodes of orphaned
+  // subtrees are not indexed, and are no node's ancestor.
+
+  void buildAncestorIndex() {
+    ancestor_index.build(int(nodes.size()), i_root, [&](int i) -> const ChildList& {
+      return nodes[i].children;
+    });
+    ancestor_index_stale = false;
+  }
+
+  bool isAncestor(int a, int b) {
+    // Whether a is b, or one of b's ancestors
+    return ancestorIndex().isAncestor(a, b);
+  }
+
+  int lowestCommonAncestor(int a, int b) {
+    // __GT_NOT_FOUND unless both are in the tree
+    return ancestorIndex().lowestCommonAncestor(a, b);
+  }
+
+  ChildSpan subtreeNodes(int i) {
+    // The nodes of the subtree at i, i first, in pre-order. Valid until the
+    // tree next changes.
+    auto r = ancestorIndex().subtree(i);
+    return { r.first, r.second };
+  }
+
+  // Compaction
+  // -----------------------------
+  // compact() removes free slots and renumbers the live nodes in pre-order, so
+  // that walks sweep the nodes vector sequentially. Subtrees orphaned by
+  // non-recursive removal are kept, numbered after the main tree.
+  //
+  // Returns a table mapping each old index to its new one (or -1 for a slot that
+  // was free).
+
+  std::vector<int> compact() {
+    std::vector<int> order;
+    collectLiveNodes(order);
+    return relayout(order);
+  }
+
 protected:
-  std::vector<NodeInfo> nodes;
+  NodeList nodes;
   std::vector<int> free_list;
+  int i_root = __GT_NOT_FOUND;
+
+  GenericTree_AncestorIndex ancestor_index;
+  bool ancestor_index_stale = true;
+
+  GenericTree_AncestorIndex& ancestorIndex() {
+    if (ancestor_index_stale) {
+      buildAncestorIndex();
+    }
+    return ancestor_index;
+  }
+#ifndef _GT_DISABLE_NODE_INDEX
+  NodeIndex node_index;    // Live nodes only
+#endif
+
+#ifdef _GT_ENABLE_ARENA
+  GenericTree_Arena *arena = NULL;
+#endif
+
+#ifdef _GT_ENABLE_STATS
+  GenericTree_Stats stat_counts;
+
+  void noteFreeListLength() {
+    if (free_list.size() > stat_counts.peak_free_list) {
+      stat_counts.peak_free_list = free_list.size();
+    }
+  }
+#endif
+
+  NodeInfo blankNode(T *x) {
+    NodeInfo node = { x, __GT_NOT_FOUND };
+#ifdef _GT_ENABLE_ARENA
+    node.children = ChildList(GenericTree_ArenaAllocator<int>(arena));
+#endif
+    return node;
+  }
+
+  int findTopNode() {
+    // Find the top node by climbing from the first live slot
+    if (isEmpty()) {
+      return __GT_NOT_FOUND;
+    }
+
+    // Only parents which list their child are followed: an orphan's stale
+    // parent may since have been reused below it
+    int i_top = firstLiveSlot();
+    for (int p; (p = nodes[i_top].index_of_parent) != __GT_NOT_FOUND && slotIsLive(p) && nodeListsChild(p, i_top); ) {
+      _GT_STAT(++stat_counts.top_climbs);
+      i_top = p;
+    }
+
+    return i_top;
+  }
+
+  void collectLiveNodes(std::vector<int> &order) {
+    // Live node indices in pre-order: the tree from the root, then any orphaned
+    // subtrees, each from its topmost live ancestor
+    std::vector<bool> seen(nodes.size(), false);
+    order.reserve(nodes.size() - free_list.size());
+
+    auto collect = [&](int i_top) {
+      traversePreorder(i_top, [&](int i, int depth) {
+        seen[i] = true;
+        order.push_back(i);
+      });
+    };
+
+    if (i_root != __GT_NOT_FOUND) {
+      collect(i_root);
+    }
+    for (int i=0, n = int(nodes.size()); i < n; ++i) {
+      if (!slotIsLive(i) || seen[i]) {
+        continue;
+      }
+
+      int i_top = i;
+      while (true) {
+        int p = nodes[i_top].index_of_parent;
+        if (p == __GT_NOT_FOUND || !slotIsLive(p) || seen[p] || !nodeListsChild(p, i_top)) {
+          break;
+        }
+        i_top = p;
+      }
+      collect(i_top);
+    }
+  }
+
+  std::vector<int> relayout(const std::vector<int> &order) {
+    // Rebuild the nodes vector with order[k] moved to index k. Every live node
+    // must appear in order exactly once. Parents are relinked from the child
+    // lists.
+    std::vector<int> remap(nodes.size(), __GT_NOT_FOUND);
+    for (int k=0, n = int(order.size()); k < n; ++k) {
+      remap[order[k]] = k;
+    }
+
+    NodeList relaid(order.size(), blankNode(NULL), nodes.get_allocator());
+    for (int k=0, n = int(order.size()); k < n; ++k) {
+      NodeInfo &node = relaid[k];
+      node.node = nodes[order[k]].node;
+      node.children.swap(nodes[order[k]].children);
+      for (auto &c : node.children) {
+        c = remap[c];
+        relaid[c].index_of_parent = k;
+      }
+    }
+
+    nodes.swap(relaid);
+    free_list.clear();
+    rebuildLiveSlots();
+    indexAllChildPositions();
+    rebuildSubtreeInfo();
+    i_root = i_root == __GT_NOT_FOUND ? __GT_NOT_FOUND : remap[i_root];
+    ancestor_index_stale = true;
+
+#ifndef _GT_DISABLE_NODE_INDEX
+    for (int k=0, n = int(nodes.size()); k < n; ++k) {
+      node_index[nodes[k].node] = k;
+    }
+#endif
+
+    return remap;
+  }
+
+  bool subtreeContains(int i, int j) {
+    // Whether j is i or one of its descendants. Uses the ancestor index if it is
+    // up to date, otherwise climbs at most nodes.size() steps, as the parents of
+    // orphaned nodes may be stale.
+    if (!ancestor_index_stale && ancestor_index.contains(i) && ancestor_index.contains(j)) {
+      return ancestor_index.isAncestor(i, j);
+    }
+    for (int k=0, n = (int) nodes.size(); j != __GT_NOT_FOUND && k <= n; j = nodes[j].index_of_parent, ++k) {
+      if (j == i) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool nodeListsChild(int parent, int child) {
+#ifdef _GT_UNORDERED_CHILDREN
+    // A listed child's index_in_parent is kept current
+    const ChildList &children = nodes[parent].children;
+    int k = nodes[child].index_in_parent;
+    return k >= 0 && k < int(children.size()) && children[k] == child;
+#else
+    for (auto c : nodes[parent].children) {
+      if (c == child) {
+        return true;
+      }
+    }
+    return false;
+#endif
+  }
 
   void removeChildren(int i) {
     _assert(i < nodes.size());
 
-    for (auto &i : nodes[i].children) {
-      removeChildren(i);
-      free_list.push_back(i);
-    }
+    // Free descendants children-first
+    traversePostorder(i, [&](int j, int depth) {
+      if (j != i) {
+        free_list.push_back(j);
+        setSlotLive(j, false);
+        _GT_STAT(noteFreeListLength());
+#ifndef _GT_DISABLE_NODE_INDEX
+        node_index.erase(nodes[j].node);
+#endif
+      }
+    });
   }
 
   bool nodeIsPresent(T &x) {
+#ifndef _GT_DISABLE_NODE_INDEX
+    return node_index.find(&x) != node_index.end();
+#else
     // The node is present if it is in the nodes array, and its index is not in
     // the free list
     int i = indexOfNode(x);
     return i != __GT_NOT_FOUND && !indexIsInFreeList(i);
+#endif
   }
 
   bool indexIsInFreeList(int ind) {
-    for (const auto &i : free_list) {
-      if (i == ind) {
-        return true;
-      }
-    }
-    return false;
+    return !slotIsLive(ind);
   }
 
   int indexOfNode(T &x) {
+    _GT_STAT(++stat_counts.index_lookups);
+#ifndef _GT_DISABLE_NODE_INDEX
+    // Probes are counted as the length of the bucket's chain
+    _GT_STAT(stat_counts.index_probes += node_index.bucket_count() ? node_index.bucket_size(node_index.bucket(&x)) : 0);
+    auto it = node_index.find(&x);
+    return it == node_index.end() ? __GT_NOT_FOUND : it->second;
+#else
     for (int i=0, n = int(nodes.size()); i < n;  ++i) {
       if (nodes[i].node == &x) {
+        _GT_STAT(stat_counts.index_probes += i + 1);
         return i;
       }
     }
+    _GT_STAT(stat_counts.index_probes += nodes.size());
     return __GT_NOT_FOUND;
+#endif
+  }
+
+  void appendChild(int parent, int child) {
+    _GT_STAT(stat_counts.child_reallocs += nodes[parent].children.size() == nodes[parent].children.capacity());
+    nodes[parent].children.push_back(child);
+#ifdef _GT_UNORDERED_CHILDREN
+    nodes[child].index_in_parent = int(nodes[parent].children.size()) - 1;
+#endif
+  }
+
+  void insertChild(int parent, int child, int position) {
+    // Insert child before the child at position, or append it if position is
+    // -1 or past the end
+    _assert(position >= -1);
+    auto &children = nodes[parent].children;
+    if (position == -1 || position >= int(children.size())) {
+      appendChild(parent, child);
+      return;
+    }
+
+    _GT_STAT(stat_counts.child_reallocs += children.size() == children.capacity());
+    children.insert(children.begin() + position, child);
+    indexChildPositions(parent);
+  }
+
+  void indexChildPositions(int parent) {
+#ifdef _GT_UNORDERED_CHILDREN
+    auto &children = nodes[parent].children;
+    for (int k=0, n = int(children.size()); k < n; ++k) {
+      nodes[children[k]].index_in_parent = k;
+    }
+#endif
+  }
+
+  void indexAllChildPositions() {
+#ifdef _GT_UNORDERED_CHILDREN
+    for (int i=0, n = int(nodes.size()); i < n; ++i) {
+      if (slotIsLive(i)) {
+        indexChildPositions(i);
+      }
+    }
+#endif
+  }
+
+  // Subtree info
+  // -----------------------------
+  // Called as nodes are added, removed, and moved, to maintain subtree sizes
+  // and depths. Empty unless _GT_ENABLE_SUBTREE_INFO is defined.
+
+  void subtreeInfo_Add(int i, int parent, int i__prev_top) {
+    // i is being added under parent, or at the top if parent is __GT_NOT_FOUND
+#ifdef _GT_ENABLE_SUBTREE_INFO
+    NodeInfo &node = nodes[i];
+    node.subtree_size = 1;
+    if (parent != __GT_NOT_FOUND) {
+      node.depth = nodes[parent].depth + 1;
+      addToAncestorSizes(parent, 1);
+    }
+    else {
+      node.depth = 0;
+      if (i__prev_top != __GT_NOT_FOUND) {
+        node.subtree_size += nodes[i__prev_top].subtree_size;
+        refreshDepths(i__prev_top, 1);
+      }
+    }
+#endif
+  }
+
+  void subtreeInfo_Detach(int i) {
+    // i's subtree is being removed from its parent
+#ifdef _GT_ENABLE_SUBTREE_INFO
+    if (nodes[i].depth > 0) {
+      addToAncestorSizes(nodes[i].index_of_parent, -nodes[i].subtree_size);
+    }
+#endif
   }
 
+  void subtreeInfo_Attach(int i) {
+    // i's subtree has been made a child of its new parent. Depths within it only
+    // change if it moved to a different depth.
+#ifdef _GT_ENABLE_SUBTREE_INFO
+    int parent = nodes[i].index_of_parent;
+    int depth  = nodes[parent].depth + 1;
+    if (nodes[i].depth != depth) {
+      refreshDepths(i, depth);
+    }
+    addToAncestorSizes(parent, nodes[i].subtree_size);
+#endif
+  }
+
+  void subtreeInfo_Orphan(int i) {
+    // i is being removed, leaving its children as the tops of detached subtrees
+#ifdef _GT_ENABLE_SUBTREE_INFO
+    for (auto c : nodes[i].children) {
+      if (slotIsLive(c) && nodes[c].index_of_parent == i) {
+        refreshDepths(c, 0);
+      }
+    }
+#endif
+  }
+
+  void rebuildSubtreeInfo() {
+    // Recompute sizes and depths from the child lists. A live node is the top
+    // of a subtree if no live node lists it as a child.
+#ifdef _GT_ENABLE_SUBTREE_INFO
+    int n = int(nodes.size());
+    std::vector<char> attached(n, 0);
+    for (int i=0; i < n; ++i) {
+      if (slotIsLive(i)) {
+        for (auto c : nodes[i].children) {
+          if (nodes[c].index_of_parent == i) {
+            attached[c] = 1;
+          }
+        }
+      }
+    }
+
+    std::vector<int> order;
+    for (int i=0; i < n; ++i) {
+      if (slotIsLive(i) && !attached[i]) {
+        traversePreorder(i, [&](int j, int depth) {
+          nodes[j].subtree_size = 1;
+          nodes[j].depth = depth;
+          order.push_back(j);
+        });
+      }
+    }
+    for (int k = int(order.size()) - 1; k >= 0; --k) {
+      NodeInfo &node = nodes[order[k]];
+      if (node.depth > 0) {
+        nodes[node.index_of_parent].subtree_size += node.subtree_size;
+      }
+    }
+#endif
+  }
+
+#ifdef _GT_ENABLE_SUBTREE_INFO
+  void addToAncestorSizes(int i, int delta) {
+    // Add delta to the subtree sizes of i and each of its ancestors
+    while (true) {
+      nodes[i].subtree_size += delta;
+      if (nodes[i].depth == 0) {
+        break;
+      }
+      i = nodes[i].index_of_parent;
+    }
+  }
+
+  void refreshDepths(int i, int depth) {
+    // Set the depths in the subtree at i, with i at depth. Only descends into
+    // children still attached to their parent, since during a batch a child
+    // list can list nodes already moved away or removed.
+    std::vector<WalkFrame> stack;
+    stack.swap(walkStack());
+    stack.push_back({ i, depth, 0 });
+
+    while (!stack.empty()) {
+      WalkFrame fr = stack.back();
+      stack.pop_back();
+      nodes[fr.i].depth = fr.depth;
+
+      for (auto c : nodes[fr.i].children) {
+        if (slotIsLive(c) && nodes[c].index_of_parent == fr.i) {
+          stack.push_back({ c, fr.depth + 1, 0 });
+        }
+      }
+    }
+
+    walkStack().swap(stack);
+  }
+#endif
+
   void removeChild_ForNodeAtIndex(int parent_ind, int child_ind) {
     _assert(parent_ind < nodes.size());
     _assert(child_ind < nodes.size());
 
     NodeInfo &parent_node = nodes[parent_ind];
-    std::vector<int> &children = parent_node.children;
-    std::vector<int>::iterator it;
+    ChildList &children = parent_node.children;
+
+#ifdef _GT_UNORDERED_CHILDREN
+    // Move the last child into the removed child's place
+    int k = nodes[child_ind].index_in_parent;
+    _assert(k >= 0 && k < int(children.size()) && children[k] == child_ind);
+    children[k] = children.back();
+    nodes[children[k]].index_in_parent = k;
+    children.pop_back();
+#else
+    typename ChildList::iterator it;
 
     for (it = children.begin(); it != children.end(); ++it) {
       if (*it == child_ind) {
         break;
       }
     }
+    _GT_STAT(stat_counts.child_scan_steps += it - children.begin());
 
     _assert(it != children.end());
     children.erase(it);
+#endif
   }
 
-  int indentCount = 0;
-  void recursivelyPrintNode(int i) {
-    for (int i=0; i < indentCount; ++i) {
-      if (i == indentCount - 1) { printf("└──"); }
-      else                      { printf("   "); }
+  // Slot liveness
+  // -----------------------------
+  // One bit per slot in the nodes vector, set while the slot is in use, i.e.
+  // not in the free list. Lets membership checks run in O(1), and scans for
+  // live slots skip 64 dead slots at a time.
+
+  std::vector<uint64_t> live_slots;
+
+  void setSlotLive(int i, bool live) {
+    size_t w = size_t(i) >> 6;
+    if (w >= live_slots.size()) {
+      live_slots.resize(w + 1, 0);
     }
+    uint64_t bit = uint64_t(1) << (i & 63);
+    if (live) { live_slots[w] |= bit;  }
+    else      { live_slots[w] &= ~bit; }
+  }
 
-    NodeInfo &n = nodes[i];
+  bool slotIsLive(int i) {
+    size_t w = size_t(i) >> 6;
+    return w < live_slots.size() && (live_slots[w] >> (i & 63)) & 1;
+  }
 
-    printf("☐  index: %d  ", i);
-    printf("children: ");
-    for (auto &i : n.children) {
-      printf("%d ", i);
+  int firstLiveSlot() {
+    for (size_t w=0, n = live_slots.size(); w < n; ++w) {
+      _GT_STAT(++stat_counts.live_slot_scans);
+      uint64_t bits = live_slots[w];
+      if (bits) {
+        int b = 0;
+        while (!(bits & 1)) { bits >>= 1; ++b; }
+        return int(w << 6) + b;
+      }
     }
-    printf(" parent: ");
-    if (n.index_of_parent == __GT_NOT_FOUND) { printf("[none]"); }
-    else                                     { printf("%d", n.index_of_parent); }
-    printf("\n");
+    return -1;
+  }
 
-    indentCount += 1;
-    for (auto &i : nodes[i].children) {
-      recursivelyPrintNode(i);
+  void rebuildLiveSlots() {
+    live_slots.assign((nodes.size() + 63) >> 6, 0);
+    for (int i=0, n = int(nodes.size()); i < n; ++i) {
+      setSlotLive(i, true);
+    }
+    for (auto i : free_list) {
+      setSlotLive(i, false);
     }
-    indentCount -= 1;
+  }
+
+  void printSubtree(int i_top) {
+    traversePreorder(i_top, [&](int i, int indent) {
+      for (int j=0; j < indent; ++j) {
+        if (j == indent - 1) { printf("└──"); }
+        else                 { printf("   "); }
+      }
+
+      NodeInfo &n = nodes[i];
+
+      printf("☐  index: %d  ", i);
+      printf("children: ");
+      for (auto &c : n.children) {
+        printf("%d ", c);
+      }
+      printf(" parent: ");
+      if (n.index_of_parent == __GT_NOT_FOUND) { printf("[none]"); }
+      else                                     { printf("%d", n.index_of_parent); }
+      printf("\n");
+    });
+  }
+
+  // Traversal
+  // -----------------------------
+  // Iterative traversal engines. These use an explicit stack rather than
+  // recursion, so arbitrarily deep trees can be walked without overflowing the
+  // thread stack. visit(i, depth) is called for each node in the subtree at i.
+  //
+  // The stack's storage is kept between walks, one per thread, so walks of a
+  // tree from several threads at once don't share it. A walk started from
+  // within a visitor swaps it out and uses its own, so nested walks are safe.
+
+  struct WalkFrame {
+    int i;
+    int depth;
+    int next_child;
+  };
+
+  static std::vector<WalkFrame>& walkStack() {
+    static thread_local std::vector<WalkFrame> stack;
+    return stack;
+  }
+
+  template <class Visitor>
+  void traversePreorder(int i_start, Visitor visit) {
+    std::vector<WalkFrame> stack;
+    stack.swap(walkStack());
+    stack.push_back({ i_start, 0, 0 });
+
+    while (!stack.empty()) {
+      WalkFrame fr = stack.back();
+      stack.pop_back();
+      visit(fr.i, fr.depth);
+
+      auto &children = nodes[fr.i].children;
+      for (int c = int(children.size()) - 1; c >= 0; --c) {
+        stack.push_back({ children[c], fr.depth + 1, 0 });
+      }
+    }
+
+    walkStack().swap(stack);
+  }
+
+  template <class Visitor>
+  void traversePostorder(int i_start, Visitor visit) {
+    std::vector<WalkFrame> stack;
+    stack.swap(walkStack());
+    stack.push_back({ i_start, 0, 0 });
+
+    while (!stack.empty()) {
+      WalkFrame &fr = stack.back();
+      auto &children = nodes[fr.i].children;
+
+      if (fr.next_child < int(children.size())) {
+        int c     = children[fr.next_child++];
+        int depth = fr.depth + 1;
+        stack.push_back({ c, depth, 0 });
+      }
+      else {
+        WalkFrame done = fr;
+        stack.pop_back();
+        visit(done.i, done.depth);
+      }
+    }
+
+    walkStack().swap(stack);
+  }
+
+  template <class Visitor>
+  void traverseLevelorder(int i_start, Visitor visit) {
+    std::vector<WalkFrame> queue;
+    queue.swap(walkStack());
+    queue.push_back({ i_start, 0, 0 });
+
+    for (size_t head = 0; head < queue.size(); ++head) {
+      WalkFrame fr = queue[head];
+      visit(fr.i, fr.depth);
+
+      for (auto c : nodes[fr.i].children) {
+        queue.push_back({ c, fr.depth + 1, 0 });
+      }
+    }
+
+    queue.clear();
+    walkStack().swap(queue);
+  }
+
+public:
+
+  // Binary snapshots
+  // -----------------------------
+  // A compact alternative to the Diatom format - see GenericTree_Binary.h.
+  // As with toDiatom(), node pointers are written as indices into an external
+  // vector of the tree's nodes.
+  // readBinary() returns false if the snapshot is truncated or malformed, leaving
+  // the tree unchanged.
+
+  bool writeBinary(FILE *f, std::vector<T*> &original_nodes) {
+    std::unordered_map<T*, int> i__ext;
+    i__ext.reserve(original_nodes.size());
+    for (int i=0, n = int(original_nodes.size()); i < n; ++i) {
+      i__ext[original_nodes[i]] = i;
+    }
+
+    std::vector<int32_t> ext(nodes.size(), __GT_NOT_FOUND);
+    for (int i=0, n = int(nodes.size()); i < n; ++i) {
+      if (slotIsLive(i)) {
+        auto it = i__ext.find(nodes[i].node);
+        _assert(it != i__ext.end());
+        ext[i] = it == i__ext.end() ? __GT_NOT_FOUND : it->second;
+      }
+    }
+
+    bool ok = GenericTree_Binary::writeStructure(
+      f, GenericTree_Binary::HasExtIndices, int(nodes.size()), i_root, free_list,
+      [&](int i) { return slotIsLive(i); },
+      [&](int i) { return nodes[i].index_of_parent; },
+      [&](int i, std::vector<int32_t> &out) {
+        out.insert(out.end(), nodes[i].children.begin(), nodes[i].children.end());
+      }
+    );
+    return ok && GenericTree_Binary::writeInts(f, ext.data(), ext.size());
+  }
+
+  bool readBinary(FILE *f, std::vector<T*> &ext_nodes) {
+    GenericTree_BinaryStructure s;
+    std::vector<int32_t> ext;
+    if (!GenericTree_Binary::readStructure(f, s) ||
+        !(s.header.flags & GenericTree_Binary::HasExtIndices) ||
+        !GenericTree_Binary::readInts(f, ext, s.header.n_nodes)) {
+      return false;
+    }
+    for (auto i : ext) {
+      if (i < __GT_NOT_FOUND || i >= int(ext_nodes.size())) {
+        return false;
+      }
+    }
+
+    reset();
+
+    int n = s.header.n_nodes;
+    nodes.resize(n, blankNode(NULL));
+    for (int i=0; i < n; ++i) {
+      nodes[i].node            = ext[i] == __GT_NOT_FOUND ? NULL : ext_nodes[ext[i]];
+      nodes[i].index_of_parent = s.parent[i];
+      nodes[i].children.assign(s.children.begin() + s.childrenBegin(i),
+                               s.children.begin() + s.childrenEnd(i));
+    }
+    free_list.assign(s.free_list.begin(), s.free_list.end());
+
+    rebuildLiveSlots();
+    indexAllChildPositions();
+    rebuildSubtreeInfo();
+    i_root = s.header.root;
+
+#ifndef _GT_DISABLE_NODE_INDEX
+    node_index.reserve(n - free_list.size());
+    for (int i=0; i < n; ++i) {
+      if (slotIsLive(i)) {
+        node_index[nodes[i].node] = i;
+      }
+    }
+#endif
+
+    return true;
+  }
+
+  bool writeBinary(const char *path, std::vector<T*> &original_nodes) {
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+      return false;
+    }
+    bool ok = writeBinary(f, original_nodes);
+    return fclose(f) == 0 && ok;
+  }
+
+  bool readBinary(const char *path, std::vector<T*> &ext_nodes) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+      return false;
+    }
+    bool ok = readBinary(f, ext_nodes);
+    fclose(f);
+    return ok;
   }
 
 #ifdef _GT_ENABLE_SERIALIZATION
@@ -327,23 +1257,8 @@ public:
 
     // Tree
     d["tree"].each([&](std::string &key, Diatom &dnode) {
-      _assert(dnode["i__ext"].is_number());
-      _assert(dnode["i__parent"].is_number());
-      _assert(dnode["i__children"].is_table());
-
-      int i__ext = (int) dnode["i__ext"].number_value;
-      _assert(i__ext >= 0 && i__ext < ext_nodes.size());
-
-      GenericTree<T>::NodeInfo n;
-      n.node            = ext_nodes[i__ext];
-      n.index_of_parent = (int) dnode["i__parent"].number_value;
-
-      dnode["i__children"].each([&](std::string &ch_key, Diatom &dc) {
-        _assert(dc.is_number());
-        n.children.push_back((int) dc.number_value);
-      });
-
-      nodes.push_back(n);
+      bool ok = loadDiatomRecord(dnode, ext_nodes);
+      _assert(ok);
     });
 
     // Free list
@@ -358,6 +1273,124 @@ public:
       //  entire nodes vector - even items that are on the free list. (Supposing we're
       //  wrong in thinking it's impossible, an assert in addNode() checks for this.)
     });
+
+    diatomLoaded();
+  }
+
+  // Streaming loads
+  // -----------------------------
+  // As for GenericTree_Nodeless: readDiatomFile() builds the tree as a file
+  // written by Diatom-Storage is parsed, without holding the document in
+  // memory, and readDiatomFileAsync() does so on a new thread, calling
+  // done(bool ok) on that thread when finished. ext_nodes is as for
+  // fromDiatom(), and must outlive an asynchronous load.
+  //
+  // Returns false if the file can't be read, or is malformed, leaving the tree
+  // empty.
+
+  bool readDiatomFile(FILE *f, std::vector<T*> &ext_nodes, const char *at = "") {
+    reset();
+
+    bool ok = GenericTree_DiatomStream<Diatom>::read(f, at,
+      [&](Diatom &dnode) { return loadDiatomRecord(dnode, ext_nodes); },
+      [&](int i) { free_list.push_back(i); return true; }
+    );
+
+    ok = ok && diatomRecordsAreValid();
+    if (!ok) {
+      reset();
+      return false;
+    }
+
+    diatomLoaded();
+    return true;
+  }
+
+  bool readDiatomFile(const char *path, std::vector<T*> &ext_nodes, const char *at = "") {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+      reset();
+      return false;
+    }
+    bool ok = readDiatomFile(f, ext_nodes, at);
+    fclose(f);
+    return ok;
+  }
+
+  template <class Done>
+  std::thread readDiatomFileAsync(const std::string &path, std::vector<T*> &ext_nodes, Done done,
+                                  const std::string &at = "") {
+    return GenericTree_DiatomStream<Diatom>::async([this, path, &ext_nodes, at]() {
+      return readDiatomFile(path.c_str(), ext_nodes, at.c_str());
+    }, done);
+  }
+
+protected:
+  bool loadDiatomRecord(Diatom &dnode, std::vector<T*> &ext_nodes) {
+    // Append the node record for the next slot
+    if (!dnode["i__ext"].is_number() || !dnode["i__parent"].is_number() || !dnode["i__children"].is_table()) {
+      return false;
+    }
+
+    typedef GenericTree_DiatomStream<Diatom> Stream;
+    int i__ext, i__parent;
+    if (!Stream::toIndex(dnode["i__ext"].number_value, i__ext) || i__ext < 0 || i__ext >= ext_nodes.size() ||
+        !Stream::toIndex(dnode["i__parent"].number_value, i__parent)) {
+      return false;
+    }
+
+    NodeInfo n = blankNode(ext_nodes[i__ext]);
+    n.index_of_parent = i__parent;
+
+    bool ok = true;
+    dnode["i__children"].each([&](std::string &ch_key, Diatom &dc) {
+      int j;
+      ok = ok && dc.is_number() && Stream::toIndex(dc.number_value, j);
+      if (ok) {
+        n.children.push_back(j);
+      }
+    });
+
+    nodes.push_back(n);
+    return ok;
+  }
+
+  bool diatomRecordsAreValid() {
+    // Free slots' records hold the links they had when freed, which are
+    // cleared, as readBinary() would have them. The nodes must then pass the
+    // checks made of binary snapshots.
+    for (auto i : free_list) {
+      if (i >= 0 && i < int(nodes.size())) {
+        nodes[i].index_of_parent = -1;
+        nodes[i].children.clear();
+      }
+    }
+
+    return GenericTree_Binary::forestIsValid(
+      int(nodes.size()), -1, free_list.data(), int(free_list.size()),
+      [&](int i) { return nodes[i].index_of_parent; },
+      [&](int i) {
+        const ChildList &ch = nodes[i].children;
+        return std::make_pair(ch.data(), ch.data() + ch.size());
+      }
+    );
+  }
+
+  void diatomLoaded() {
+    rebuildLiveSlots();
+    indexAllChildPositions();
+    rebuildSubtreeInfo();
+    i_root = findTopNode();
+
+#ifndef _GT_DISABLE_NODE_INDEX
+    // Index the live nodes
+    node_index.reserve(nodes.size() - free_list.size());
+    for (int i=0, n = int(nodes.size()); i < n; ++i) {
+      if (!indexIsInFreeList(i)) {
+        node_index[nodes[i].node] = i;
+      }
+    }
+#endif
   }
 
 protected:
@@ -0,0 +1,236 @@
+//
+// GenericTreeView.h
+//
+// A read-only view of a binary tree snapshot (see GenericTree_Binary.h), used in
+// place by memory-mapping the snapshot file.
+//
+// - Nothing is deserialized: queries and walks read the mapped bytes directly, so
+//   opening is near-instant, and processes mapping the same file share one
+//   physical copy of it
+// - Works with snapshots written by any of the tree classes
+// - The view cannot be modified; const methods may be called from several threads
+// - Uses POSIX mmap
+//
+// MIT licensed: http://opensource.org/licenses/MIT
+//
+
+#ifndef __GenericTreeView_h
+#define __GenericTreeView_h
+
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "GenericTree_Binary.h"
+
+// Optionally disable asserts
+#ifdef _GT_DISABLE_SAFETY_CHECKS
+  #define _assert(x)
+#else
+  #include <cassert>
+  #define _assert(x) assert(x)
+#endif
+
+
+class GenericTreeView {
+public:
+  struct ChildSpan {
+    const int32_t *first;
+    const int32_t *last;
+
+    const int32_t* begin() const { return first; }
+    const int32_t* end()   const { return last; }
+    int  size()  const { return int(last - first); }
+    bool empty() const { return first == last; }
+    int  operator[](int k) const { return first[k]; }
+  };
+
+  GenericTreeView() { }
+  ~GenericTreeView() { close(); }
+
+  GenericTreeView(const GenericTreeView &) = delete;
+  GenericTreeView& operator=(const GenericTreeView &) = delete;
+
+  // open()
+  //  - maps the snapshot at path, returning false if it cannot be mapped or is malformed
+  //  - validation (see GenericTree_Binary::structureIsValid) touches the whole
+  //    structure once, and rejects snapshots whose child lists form cycles;
+  //    pass validate = false to skip this for trusted files
+
+  bool open(const char *path, bool validate = true) {
+    close();
+
+    int fd = ::open(path, O_RDONLY);
+    if (fd == -1) {
+      return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(GenericTree_BinaryHeader)) {
+      ::close(fd);
+      return false;
+    }
+
+    void *p = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) {
+      return false;
+    }
+
+    mapping      = p;
+    mapping_size = (size_t) st.st_size;
+
+    if (!bind(validate)) {
+      close();
+      return false;
+    }
+    return true;
+  }
+
+  void close() {
+    if (mapping) {
+      munmap(mapping, mapping_size);
+    }
+    mapping           = NULL;
+    mapping_size      = 0;
+    header            = NULL;
+    sec_parent        = NULL;
+    sec_child_offsets = NULL;
+    sec_children      = NULL;
+    sec_free_list     = NULL;
+    sec_ext_index     = NULL;
+  }
+
+  bool isOpen() const {
+    return header != NULL;
+  }
+
+  int nNodes() const {
+    // Number of slots, including free ones
+    return header ? header->n_nodes : 0;
+  }
+
+  int nFree() const {
+    return header ? header->n_free : 0;
+  }
+
+  bool isEmpty() const {
+    return nNodes() == nFree();
+  }
+
+  int indexOfTopNode() const {
+    return header ? header->root : -1;
+  }
+
+  int parentIndex(int i) const {
+    _assert(i >= 0 && i < nNodes());
+    return sec_parent[i];
+  }
+
+  int nChildren(int i) const {
+    _assert(i >= 0 && i < nNodes());
+    return sec_child_offsets[i + 1] - sec_child_offsets[i];
+  }
+
+  int indexForChild(int parent, int child_in_children_vec) const {
+    _assert(parent >= 0 && parent < nNodes());
+    _assert(child_in_children_vec >= 0 && child_in_children_vec < nChildren(parent));
+    return sec_children[sec_child_offsets[parent] + child_in_children_vec];
+  }
+
+  ChildSpan children(int i) const {
+    _assert(i >= 0 && i < nNodes());
+    return { sec_children + sec_child_offsets[i], sec_children + sec_child_offsets[i + 1] };
+  }
+
+  int indexInFreeList(int k) const {
+    _assert(k >= 0 && k < nFree());
+    return sec_free_list[k];
+  }
+
+  bool hasExtIndices() const {
+    return sec_ext_index != NULL;
+  }
+
+  int extIndex(int i) const {
+    // For snapshots written by GenericTree: node i's index in the external vector
+    _assert(hasExtIndices());
+    _assert(i >= 0 && i < nNodes());
+    return sec_ext_index[i];
+  }
+
+  template <class Functor>
+  void walk(Functor f, int i = -2) const {
+    // Parents before children, as GenericTree_Nodeless::walk(). At most nNodes()
+    // nodes are visited, so a walk of an unvalidated snapshot with a cycle
+    // still ends.
+    if (i == -2) {
+      i = indexOfTopNode();
+    }
+
+    if (i == -1) {
+      return;
+    }
+
+    std::vector<int> stack;
+    stack.push_back(i);
+    for (int n_visits = 0; !stack.empty() && n_visits < nNodes(); ++n_visits) {
+      int j = stack.back();
+      stack.pop_back();
+      f(j);
+
+      for (int k = sec_child_offsets[j + 1] - 1; k >= sec_child_offsets[j]; --k) {
+        stack.push_back(sec_children[k]);
+      }
+    }
+  }
+
+protected:
+  void   *mapping      = NULL;
+  size_t  mapping_size = 0;
+
+  const GenericTree_BinaryHeader *header = NULL;
+  const int32_t *sec_parent        = NULL;
+  const int32_t *sec_child_offsets = NULL;
+  const int32_t *sec_children      = NULL;
+  const int32_t *sec_free_list     = NULL;
+  const int32_t *sec_ext_index     = NULL;
+
+  bool bind(bool validate) {
+    const GenericTree_BinaryHeader *h = (const GenericTree_BinaryHeader*) mapping;
+    if (!GenericTree_Binary::headerIsValid(*h)) {
+      return false;
+    }
+
+    size_t size = GenericTree_Binary::structureSize(*h);
+    if (h->flags & GenericTree_Binary::HasExtIndices) {
+      size += sizeof(int32_t) * h->n_nodes;
+    }
+    if (size > mapping_size) {
+      return false;
+    }
+
+    const int32_t *p = (const int32_t*) (h + 1);
+    sec_parent        = p;  p += h->n_nodes;
+    sec_child_offsets = p;  p += h->n_nodes + 1;
+    sec_children      = p;  p += h->n_child_entries;
+    sec_free_list     = p;  p += h->n_free;
+    sec_ext_index     = (h->flags & GenericTree_Binary::HasExtIndices) ? p : NULL;
+
+    if (validate && !GenericTree_Binary::structureIsValid(*h, sec_parent, sec_child_offsets,
+                                                          sec_children, sec_free_list)) {
+      return false;
+    }
+
+    header = h;
+    return true;
+  }
+};
+
+
+#endif  // ifndef __GenericTreeView_h
@@ -0,0 +1,180 @@
+//
+// GenericTree_AncestorIndex.h
+//
+// Pre-order interval labels for a tree, used by the trees' ancestor queries.
+//
+// - Each indexed node gets its position in a pre-order walk (enter), and the
+//   position just past its subtree (leave), so a is an ancestor of b exactly
+//   when enter[a] <= enter[b] < leave[a]
+// - A node's subtree is a contiguous range of the pre-order
+// - Lowest common ancestors are found by a range-minimum query over the
+//   pre-order positions of each node's parent: for l < r, the LCA of the
+//   nodes at l and r is the node at the smallest parent position in (l, r].
+//   Minima of blocks of 32 positions are kept in a sparse table, so a query
+//   scans at most two partial blocks, and memory is O(n) rather than
+//   O(n log n).
+// - Only nodes reachable from the root passed to build() are indexed
+//
+// MIT licensed: http://opensource.org/licenses/MIT
+//
+
+#ifndef __GenericTree_AncestorIndex_h
+#define __GenericTree_AncestorIndex_h
+
+#include <vector>
+#include <utility>
+#include <algorithm>
+
+
+class GenericTree_AncestorIndex {
+public:
+  template <class ChildrenOf>
+  void build(int n_slots, int root, ChildrenOf children_of) {
+    // children_of(i): node i's child indices (size() and operator[])
+    enter.assign(n_slots, -1);
+    leave.assign(n_slots, -1);
+    order.clear();
+    parent_pos.clear();
+
+    if (root != -1) {
+      std::vector<std::pair<int, int>> stack;   // (node, next child)
+      enter[root] = 0;
+      order.push_back(root);
+      parent_pos.push_back(-1);
+      stack.push_back({ root, 0 });
+
+      while (!stack.empty()) {
+        std::pair<int, int> &fr = stack.back();
+        auto &&ch = children_of(fr.first);
+
+        if (fr.second < int(ch.size())) {
+          int c = ch[fr.second++];
+          int p = enter[fr.first];
+          enter[c] = int(order.size());
+          order.push_back(c);
+          parent_pos.push_back(p);
+          stack.push_back({ c, 0 });
+        }
+        else {
+          leave[fr.first] = int(order.size());
+          stack.pop_back();
+        }
+      }
+    }
+
+    buildBlocks();
+  }
+
+  bool contains(int i) const {
+    return i >= 0 && i < int(enter.size()) && enter[i] != -1;
+  }
+
+  bool isAncestor(int a, int b) const {
+    // Whether a is b or one of its ancestors
+    return contains(a) && contains(b) && enter[a] <= enter[b] && enter[b] < leave[a];
+  }
+
+  int lowestCommonAncestor(int a, int b) const {
+    // -1 unless both nodes are indexed
+    if (!contains(a) || !contains(b)) {
+      return -1;
+    }
+
+    int l = enter[a];
+    int r = enter[b];
+    if (l == r) {
+      return a;
+    }
+    if (l > r) {
+      std::swap(l, r);
+    }
+    return order[rangeMin(l + 1, r)];
+  }
+
+  std::pair<const int*, const int*> subtree(int i) const {
+    // The nodes of the subtree at i, in pre-order
+    if (!contains(i)) {
+      return { nullptr, nullptr };
+    }
+    return { order.data() + enter[i], order.data() + leave[i] };
+  }
+
+  const std::vector<int>& preorder() const {
+    return order;
+  }
+
+  void clear() {
+    enter.clear();
+    leave.clear();
+    order.clear();
+    parent_pos.clear();
+    block_min.clear();
+    log2_of.clear();
+  }
+
+private:
+  static const int BlockShift = 5;
+  static const int BlockSize  = 1 << BlockShift;
+
+  std::vector<int> enter;         // Pre-order position of each slot, or -1
+  std::vector<int> leave;         // Position just past each slot's subtree
+  std::vector<int> order;         // The indexed nodes, in pre-order
+  std::vector<int> parent_pos;    // Pre-order position of the parent of order[k]
+
+  std::vector<std::vector<int>> block_min;   // [level][block]: min over 2^level blocks
+  std::vector<int> log2_of;
+
+  void buildBlocks() {
+    int n_blocks = (int(parent_pos.size()) + BlockSize - 1) >> BlockShift;
+
+    block_min.assign(1, std::vector<int>(n_blocks));
+    for (int b=0; b < n_blocks; ++b) {
+      int lo = b << BlockShift;
+      int hi = std::min(lo + BlockSize, int(parent_pos.size())) - 1;
+      block_min[0][b] = scanMin(lo, hi);
+    }
+
+    for (int level = 1; (1 << level) <= n_blocks; ++level) {
+      const std::vector<int> &prev = block_min[level - 1];
+      std::vector<int> cur(n_blocks - (1 << level) + 1);
+      for (int b=0, n = int(cur.size()); b < n; ++b) {
+        cur[b] = std::min(prev[b], prev[b + (1 << (level - 1))]);
+      }
+      block_min.push_back(cur);
+    }
+
+    log2_of.assign(n_blocks + 1, 0);
+    for (int k=2; k <= n_blocks; ++k) {
+      log2_of[k] = log2_of[k >> 1] + 1;
+    }
+  }
+
+  int scanMin(int lo, int hi) const {
+    int m = parent_pos[lo];
+    for (int k = lo + 1; k <= hi; ++k) {
+      m = std::min(m, parent_pos[k]);
+    }
+    return m;
+  }
+
+  int rangeMin(int lo, int hi) const {
+    // Minimum of parent_pos[lo..hi]
+    int b_lo = lo >> BlockShift;
+    int b_hi = hi >> BlockShift;
+    if (b_hi - b_lo <= 1) {
+      return scanMin(lo, hi);
+    }
+
+    int m = std::min(scanMin(lo, ((b_lo + 1) << BlockShift) - 1),
+                     scanMin(b_hi << BlockShift, hi));
+
+    int n = b_hi - b_lo - 1;
+    int level = log2_of[n];
+    m = std::min(m, block_min[level][b_lo + 1]);
+    m = std::min(m, block_min[level][b_hi - (1 << level)]);
+    return m;
+  }
+};
+
+
+#endif  // ifndef __GenericTree_AncestorIndex_h
@@ -0,0 +1,137 @@
+//
+// GenericTree_Arena.h
+//
+// A monotonic arena, and an allocator which draws from it, for the trees' node
+// and child list storage (see _GT_ENABLE_ARENA and _GTR_ENABLE_ARENA).
+//
+// - Allocation bumps a pointer through large blocks; deallocation does nothing
+// - reset() makes all of the arena's memory available again in O(1), keeping its
+//   blocks, so once an arena has grown to the size of a typical tree, building
+//   and tearing down further trees doesn't touch the global heap
+// - Memory freed by a tree (e.g. when a child list grows) is not reused until
+//   the arena is reset, so an arena suits short-lived trees
+// - Not thread-safe: each thread building trees should use its own arena
+//
+// MIT licensed: http://opensource.org/licenses/MIT
+//
+
+#ifndef __GenericTree_Arena_h
+#define __GenericTree_Arena_h
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+
+
+class GenericTree_Arena {
+public:
+  explicit GenericTree_Arena(size_t _block_size = 1 << 16) : block_size(_block_size) { }
+
+  ~GenericTree_Arena() {
+    for (auto &b : blocks) {
+      ::operator delete(b.p);
+    }
+  }
+
+  GenericTree_Arena(const GenericTree_Arena &) = delete;
+  GenericTree_Arena& operator=(const GenericTree_Arena &) = delete;
+
+  void* allocate(size_t n, size_t align) {
+    // Blocks come from operator new, so offsets aligned relative to the start
+    // of a block are aligned for any fundamental type
+    while (i_block < blocks.size()) {
+      Block &b = blocks[i_block];
+      size_t offset = (used + align - 1) & ~(align - 1);
+      if (offset + n <= b.size) {
+        used = offset + n;
+        return b.p + offset;
+      }
+      ++i_block;
+      used = 0;
+    }
+
+    // Out of blocks: add one, big enough for this allocation
+    size_t size = n > block_size ? n : block_size;
+    Block b = { (char*) ::operator new(size), size };
+    blocks.push_back(b);
+
+    used = n;
+    return b.p;
+  }
+
+  void reset() {
+    // Make all memory available again. Anything allocated from the arena must
+    // no longer be in use.
+    i_block = 0;
+    used    = 0;
+  }
+
+  size_t capacity() const {
+    size_t total = 0;
+    for (auto &b : blocks) {
+      total += b.size;
+    }
+    return total;
+  }
+
+private:
+  struct Block {
+    char   *p;
+    size_t  size;
+  };
+
+  std::vector<Block> blocks;
+  size_t block_size;
+  size_t i_block = 0;
+  size_t used    = 0;    // Bytes used in blocks[i_block]
+};
+
+
+// GenericTree_ArenaAllocator
+// -----------------------------
+// Allocates from an arena, or from the global heap if constructed without one.
+// Containers propagate the allocator when assigned or swapped, so storage
+// always returns to the allocator it came from.
+
+template <class T>
+struct GenericTree_ArenaAllocator {
+  typedef T value_type;
+  typedef std::true_type propagate_on_container_copy_assignment;
+  typedef std::true_type propagate_on_container_move_assignment;
+  typedef std::true_type propagate_on_container_swap;
+
+  GenericTree_Arena *arena;
+
+  GenericTree_ArenaAllocator(GenericTree_Arena *_arena = NULL) : arena(_arena) { }
+
+  template <class U>
+  GenericTree_ArenaAllocator(const GenericTree_ArenaAllocator<U> &other) : arena(other.arena) { }
+
+  T* allocate(size_t n) {
+    if (arena) {
+      return (T*) arena->allocate(n * sizeof(T), alignof(T));
+    }
+    return (T*) ::operator new(n * sizeof(T));
+  }
+
+  void deallocate(T *p, size_t n) {
+    if (!arena) {
+      ::operator delete(p);
+    }
+  }
+};
+
+template <class T, class U>
+bool operator==(const GenericTree_ArenaAllocator<T> &a, const GenericTree_ArenaAllocator<U> &b) {
+  return a.arena == b.arena;
+}
+
+template <class T, class U>
+bool operator!=(const GenericTree_ArenaAllocator<T> &a, const GenericTree_ArenaAllocator<U> &b) {
+  return a.arena != b.arena;
+}
+
+
+#endif  // ifndef __GenericTree_Arena_h
@@ -0,0 +1,280 @@
+//
+// GenericTree_Binary.h
+//
+// The binary snapshot format shared by the tree classes' writeBinary() and
+// readBinary() methods - a compact alternative to the Diatom format.
+//
+// Layout:
+//  - a 32-byte GenericTree_BinaryHeader
+//  - int32 parent[n_nodes]               -1 for the root and for free slots
+//  - int32 child_offsets[n_nodes + 1]    node i's children are
+//                                          children[child_offsets[i] .. child_offsets[i+1])
+//  - int32 children[n_child_entries]
+//  - int32 free_list[n_free]
+//  - any class-specific sections, as given by the header flags:
+//     - HasExtIndices: int32 ext_index[n_nodes] (GenericTree), -1 for free slots
+//     - HasChildPositions: int32 child_position[n_child_entries], each child's
+//                      position in its parent's fixed child array (GenericTree_Fixed)
+//     - HasPayloads:   a payload per live slot, in slot order, as written by a codec
+//                      (GenericTree_Referential)
+//
+// Every section is 4-byte aligned, so a snapshot can be used in place once mapped
+// into memory (see GenericTreeView). Values are in the writer's native byte order;
+// readers reject snapshots whose magic does not match.
+//
+// MIT licensed: http://opensource.org/licenses/MIT
+//
+
+#ifndef __GenericTree_Binary_h
+#define __GenericTree_Binary_h
+
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+
+
+struct GenericTree_BinaryHeader {
+  char     magic[4];
+  uint32_t version;
+  uint32_t flags;
+  int32_t  n_nodes;
+  int32_t  n_free;
+  int32_t  root;
+  int32_t  n_child_entries;
+  uint32_t reserved;
+};
+
+
+struct GenericTree_BinaryStructure {
+  GenericTree_BinaryHeader header;
+  std::vector<int32_t> parent;
+  std::vector<int32_t> child_offsets;
+  std::vector<int32_t> children;
+  std::vector<int32_t> free_list;
+
+  int childrenBegin(int i) const { return child_offsets[i]; }
+  int childrenEnd(int i)   const { return child_offsets[i + 1]; }
+};
+
+
+struct GenericTree_Binary {
+  static const uint32_t Version = 1;
+
+  enum Flags {
+    HasExtIndices     = 1,
+    HasPayloads       = 2,
+    HasChildPositions = 4,
+  };
+
+  static const char* magic() {
+    return "GTB1";
+  }
+
+  static size_t structureSize(const GenericTree_BinaryHeader &h) {
+    // Size in bytes of the header and shared sections
+    return sizeof(GenericTree_BinaryHeader) +
+           sizeof(int32_t) * (size_t(h.n_nodes) * 2 + 1 + h.n_child_entries + h.n_free);
+  }
+
+  static bool headerIsValid(const GenericTree_BinaryHeader &h) {
+    return memcmp(h.magic, magic(), 4) == 0 &&
+           h.version == Version &&
+           h.n_nodes >= 0 &&
+           h.n_free >= 0 && h.n_free <= h.n_nodes &&
+           h.n_child_entries >= 0 && h.n_child_entries <= h.n_nodes &&
+           h.root >= -1 && h.root < h.n_nodes;
+  }
+
+  template <class Int>
+  static bool writeInts(FILE *f, const Int *x, size_t n) {
+    static_assert(sizeof(Int) == sizeof(int32_t), "Snapshot sections are arrays of int32");
+    return n == 0 || fwrite(x, sizeof(Int), n, f) == n;
+  }
+
+  template <class Int>
+  static bool readInts(FILE *f, std::vector<Int> &x, size_t n) {
+    static_assert(sizeof(Int) == sizeof(int32_t), "Snapshot sections are arrays of int32");
+    x.resize(n);
+    return n == 0 || fread(x.data(), sizeof(Int), n, f) == n;
+  }
+
+
+  // writeStructure
+  // -----------------------------
+  // Write the header & shared sections of a tree with n_nodes slots.
+  //  - is_live(i):           whether slot i is in use
+  //  - parent_of(i):         the parent of live node i
+  //  - each_child(i, out):   append the children of live node i to out, in order
+
+  template <class IsLive, class ParentOf, class EachChild>
+  static bool writeStructure(FILE *f, uint32_t flags, int n_nodes, int root,
+                             const std::vector<int> &free_list,
+                             IsLive is_live, ParentOf parent_of, EachChild each_child) {
+    std::vector<int32_t> parent(n_nodes, -1);
+    std::vector<int32_t> child_offsets(n_nodes + 1, 0);
+    std::vector<int32_t> children;
+    children.reserve(n_nodes);
+
+    for (int i=0; i < n_nodes; ++i) {
+      child_offsets[i] = (int32_t) children.size();
+      if (!is_live(i)) {
+        continue;
+      }
+      parent[i] = parent_of(i);
+      each_child(i, children);
+    }
+    child_offsets[n_nodes] = (int32_t) children.size();
+
+    GenericTree_BinaryHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, magic(), 4);
+    h.version         = Version;
+    h.flags           = flags;
+    h.n_nodes         = n_nodes;
+    h.n_free          = (int32_t) free_list.size();
+    h.root            = root;
+    h.n_child_entries = (int32_t) children.size();
+
+    return fwrite(&h, sizeof(h), 1, f) == 1 &&
+           writeInts(f, parent.data(), parent.size()) &&
+           writeInts(f, child_offsets.data(), child_offsets.size()) &&
+           writeInts(f, children.data(), children.size()) &&
+           writeInts(f, free_list.data(), free_list.size());
+  }
+
+
+  // readStructure
+  // -----------------------------
+  // Read and validate the header & shared sections. Returns false if the snapshot
+  // is truncated or malformed, in which case s should be discarded.
+
+  static bool readStructure(FILE *f, GenericTree_BinaryStructure &s) {
+    GenericTree_BinaryHeader &h = s.header;
+    if (fread(&h, sizeof(h), 1, f) != 1 || !headerIsValid(h)) {
+      return false;
+    }
+
+    if (!readInts(f, s.parent, h.n_nodes) ||
+        !readInts(f, s.child_offsets, size_t(h.n_nodes) + 1) ||
+        !readInts(f, s.children, h.n_child_entries) ||
+        !readInts(f, s.free_list, h.n_free)) {
+      return false;
+    }
+
+    return structureIsValid(h, s.parent.data(), s.child_offsets.data(),
+                            s.children.data(), s.free_list.data());
+  }
+
+  // structureIsValid
+  // -----------------------------
+  // Whether the shared sections describe a forest the tree classes can use:
+  // child ranges must be ordered, and the nodes must pass forestIsValid().
+
+  static bool structureIsValid(const GenericTree_BinaryHeader &h,
+                               const int32_t *parent, const int32_t *child_offsets,
+                               const int32_t *children, const int32_t *free_list) {
+    int n = h.n_nodes;
+
+    if (child_offsets[0] != 0 || child_offsets[n] != h.n_child_entries) {
+      return false;
+    }
+    for (int i=0; i < n; ++i) {
+      if (child_offsets[i] > child_offsets[i + 1]) {
+        return false;
+      }
+    }
+
+    return forestIsValid(n, h.root, free_list, h.n_free,
+      [&](int i) { return parent[i]; },
+      [&](int i) {
+        return std::make_pair(children + child_offsets[i], children + child_offsets[i + 1]);
+      }
+    );
+  }
+
+
+  // forestIsValid
+  // -----------------------------
+  // Check the nodes of a tree with n slots, as loaded from a file:
+  //  - parent_of(i):     slot i's parent, or -1
+  //  - children_of(i):   a (first, last) pair of pointers to slot i's children
+  //
+  //  - every index is in range
+  //  - free list entries are distinct, and free slots have no parent or
+  //    children
+  //  - each child entry names a live node whose parent is the entry's owner,
+  //    and no node is listed twice
+  //  - the root, if any, is live and has no parent
+  //  - there are no cycles: walking down from the live nodes no node lists
+  //    reaches every live node
+  // Live nodes no node lists are the tops of orphaned subtrees (or the root).
+  // An orphan's parent may be stale - freed, or reused by a node which doesn't
+  // list it - as the trees leave it after non-recursive removal.
+
+  template <class Int, class ParentOf, class ChildrenOf>
+  static bool forestIsValid(int n, int root, const Int *free_list, int n_free,
+                            ParentOf parent_of, ChildrenOf children_of) {
+    if (root < -1 || root >= n || n_free < 0 || n_free > n) {
+      return false;
+    }
+    for (int i=0; i < n; ++i) {
+      if (parent_of(i) < -1 || parent_of(i) >= n) {
+        return false;
+      }
+    }
+
+    enum { Unlisted, Listed, Free };
+    std::vector<uint8_t> state(n, Unlisted);
+
+    for (int k=0; k < n_free; ++k) {
+      int i = free_list[k];
+      if (i < 0 || i >= n || state[i] == Free || parent_of(i) != -1) {
+        return false;
+      }
+      auto ch = children_of(i);
+      if (ch.first != ch.second) {
+        return false;
+      }
+      state[i] = Free;
+    }
+
+    for (int i=0; i < n; ++i) {
+      auto ch = children_of(i);
+      for (auto c = ch.first; c != ch.second; ++c) {
+        if (*c < 0 || *c >= n || state[*c] != Unlisted || parent_of(*c) != i) {
+          return false;
+        }
+        state[*c] = Listed;
+      }
+    }
+
+    if (root != -1 && (state[root] != Unlisted || parent_of(root) != -1)) {
+      return false;
+    }
+
+    // Every live node must be reachable from an unlisted one
+    int n_live = n - n_free;
+    int n_reached = 0;
+    std::vector<int32_t> stack;
+    for (int i=0; i < n; ++i) {
+      if (state[i] != Unlisted) {
+        continue;
+      }
+      stack.push_back(i);
+      while (!stack.empty()) {
+        int j = stack.back();
+        stack.pop_back();
+        ++n_reached;
+        auto ch = children_of(j);
+        stack.insert(stack.end(), ch.first, ch.second);
+      }
+    }
+
+    return n_reached == n_live;
+  }
+};
+
+
+#endif  // ifndef __GenericTree_Binary_h
@@ -0,0 +1,342 @@
+//
+// GenericTree_Concurrent.h
+//
+// A version of GenericTree_Nodeless for one writer thread and any number of
+// reader threads.
+//
+// - Readers take an immutable Snapshot of the tree, which they can walk and
+//   query for as long as they hold it, while the writer carries on modifying
+//   the tree. Readers don't block on the writer's modifications; they wait
+//   only briefly while a snapshot is handed over (see below).
+// - Node slots are stored in fixed-size chunks, shared between the writer and
+//   the snapshots. The first time the writer modifies a chunk after a publish,
+//   it copies that chunk (copy-on-write), so publishing costs one pointer per
+//   chunk, and a snapshot's memory is that of the chunks changed since.
+// - The writer's changes become visible to readers when it calls publish().
+//   Versions are reclaimed when the last snapshot referring to them is released.
+// - Snapshots are published and acquired with std::atomic_store/atomic_load on
+//   a shared_ptr. These are not lock-free in common standard libraries, which
+//   guard them with a global pool of spinlocks: acquiring a snapshot waits for
+//   any publish, or other acquire, in progress on the same lock, for the time it
+//   takes to copy a shared_ptr.
+//
+// MIT licensed: http://opensource.org/licenses/MIT
+//
+
+#ifndef __GenericTree_Concurrent_h
+#define __GenericTree_Concurrent_h
+
+#include <vector>
+#include <memory>
+#include <utility>
+#include <atomic>
+#include <cstdint>
+
+// Optionally disable asserts
+#ifdef _GT_DISABLE_SAFETY_CHECKS
+  #define _assert(x)
+#else
+  #include <cassert>
+  #define _assert(x) assert(x)
+#endif
+
+
+class GenericTree_Concurrent {
+public:
+  struct Node {
+    int  parent = -1;
+    bool live   = false;
+    std::vector<int> children;
+  };
+
+  static const int ChunkShift = 6;
+  static const int ChunkSize  = 1 << ChunkShift;
+  static const int ChunkMask  = ChunkSize - 1;
+
+  struct Chunk {
+    Node nodes[ChunkSize];
+  };
+
+  struct ChildSpan {
+    const int *first;
+    const int *last;
+
+    const int* begin() const { return first; }
+    const int* end()   const { return last; }
+    int  size()  const { return int(last - first); }
+    bool empty() const { return first == last; }
+    int  operator[](int k) const { return first[k]; }
+  };
+
+
+  // Snapshot
+  // -----------------------------
+  // An immutable version of the tree. All methods are const, and may be called
+  // from any number of threads.
+
+  class Snapshot {
+  public:
+    uint64_t version() const {
+      // Incremented by each publish()
+      return n_version;
+    }
+
+    int nNodes() const {
+      // Number of slots, including free ones
+      return n_nodes;
+    }
+
+    int indexOfTopNode() const {
+      return root;
+    }
+
+    bool isEmpty() const {
+      return root == -1;
+    }
+
+    bool nodeIsPresent(int i) const {
+      return i >= 0 && i < n_nodes && node(i).live;
+    }
+
+    int parentIndex(int i) const {
+      _assert(i >= 0 && i < n_nodes);
+      return node(i).parent;
+    }
+
+    int nChildren(int i) const {
+      _assert(i >= 0 && i < n_nodes);
+      return (int) node(i).children.size();
+    }
+
+    int indexForChild(int parent, int child_in_children_vec) const {
+      _assert(parent >= 0 && parent < n_nodes);
+      _assert(child_in_children_vec >= 0 && child_in_children_vec < nChildren(parent));
+      return node(parent).children[child_in_children_vec];
+    }
+
+    ChildSpan children(int i) const {
+      _assert(i >= 0 && i < n_nodes);
+      const std::vector<int> &ch = node(i).children;
+      return { ch.data(), ch.data() + ch.size() };
+    }
+
+    template <class Functor>
+    void walk(Functor f, int i = -2) const {
+      // Parents before children, as GenericTree_Nodeless::walk()
+      if (i == -2) {
+        i = root;
+      }
+
+      if (i == -1) {
+        return;
+      }
+
+      std::vector<int> stack;
+      stack.push_back(i);
+      while (!stack.empty()) {
+        int j = stack.back();
+        stack.pop_back();
+        f(j);
+
+        const std::vector<int> &ch = node(j).children;
+        for (int c = int(ch.size()) - 1; c >= 0; --c) {
+          stack.push_back(ch[c]);
+        }
+      }
+    }
+
+  private:
+    friend class GenericTree_Concurrent;
+
+    std::vector<std::shared_ptr<const Chunk>> chunks;
+    int      n_nodes   = 0;
+    int      root      = -1;
+    uint64_t n_version = 0;
+
+    const Node& node(int i) const {
+      return chunks[i >> ChunkShift]->nodes[i & ChunkMask];
+    }
+  };
+
+  typedef std::shared_ptr<const Snapshot> SnapshotPtr;
+
+
+  GenericTree_Concurrent() {
+    publish();
+  }
+
+  // Reader side
+  // -----------------------------
+
+  SnapshotPtr snapshot() const {
+    // The most recently published version. Briefly contends with publish()
+    // and other callers (see the header comment).
+    return std::atomic_load(&published);
+  }
+
+
+  // Writer side
+  // -----------------------------
+  // These must only be called from the writer thread. Queries here see the
+  // writer's own, possibly unpublished, changes.
+
+  void publish() {
+    std::shared_ptr<Snapshot> s = std::make_shared<Snapshot>();
+    s->chunks.assign(chunks.begin(), chunks.end());
+    s->n_nodes   = n_nodes;
+    s->root      = root;
+    s->n_version = ++n_version;
+
+    // Every chunk is now shared with the snapshot
+    chunk_is_private.assign(chunks.size(), false);
+
+    std::atomic_store(&published, SnapshotPtr(s));
+  }
+
+  void reset() {
+    chunks.clear();
+    chunk_is_private.clear();
+    free_list.clear();
+    n_nodes = 0;
+    root    = -1;
+  }
+
+  int addNode(int parent) {
+    // As GenericTree_Nodeless::addNode()
+    int i = -1;
+    int i__prev_top = root;
+
+    if (free_list.size() > 0) {
+      i = free_list.back();
+      free_list.pop_back();
+    }
+    else {
+      i = n_nodes++;
+      if ((i >> ChunkShift) == int(chunks.size())) {
+        chunks.push_back(std::make_shared<Chunk>());
+        chunk_is_private.push_back(true);
+      }
+    }
+
+    Node &node = writable(i);
+    node.parent = parent;
+    node.live   = true;
+    node.children.clear();
+
+    if (parent != -1) {
+      _assert(nodeIsPresent(parent));
+      writable(parent).children.push_back(i);
+    }
+    else {
+      if (i__prev_top != -1) {
+        writable(i).children.push_back(i__prev_top);
+        writable(i__prev_top).parent = i;
+      }
+      root = i;
+    }
+
+    return i;
+  }
+
+  void removeNode(int i, bool recursively_remove_children) {
+    // As GenericTree_Nodeless::removeNode()
+    _assert(nodeIsPresent(i));
+
+    writable(i).live = false;
+    free_list.push_back(i);
+
+    int parent = node(i).parent;
+    if (parent != -1 && nodeIsPresent(parent)) {
+      std::vector<int> &ch = writable(parent).children;
+      for (auto it = ch.begin(); it != ch.end(); ++it) {
+        if (*it == i) {
+          ch.erase(it);
+          break;
+        }
+      }
+    }
+    if (i == root) {
+      root = -1;
+    }
+
+    if (recursively_remove_children) {
+      removeChildren(i);
+    }
+  }
+
+  int indexOfTopNode() const {
+    return root;
+  }
+
+  bool nodeIsPresent(int i) const {
+    return i >= 0 && i < n_nodes && node(i).live;
+  }
+
+  int parentIndex(int i) const {
+    _assert(i >= 0 && i < n_nodes);
+    return node(i).parent;
+  }
+
+  int nChildren(int i) const {
+    _assert(i >= 0 && i < n_nodes);
+    return (int) node(i).children.size();
+  }
+
+  int indexForChild(int parent, int child_in_children_vec) const {
+    _assert(parent >= 0 && parent < n_nodes);
+    _assert(child_in_children_vec >= 0 && child_in_children_vec < nChildren(parent));
+    return node(parent).children[child_in_children_vec];
+  }
+
+protected:
+  std::vector<std::shared_ptr<Chunk>> chunks;
+  std::vector<bool> chunk_is_private;   // Not shared with any snapshot
+  std::vector<int>  free_list;
+  int      n_nodes   = 0;
+  int      root      = -1;
+  uint64_t n_version = 0;
+
+  SnapshotPtr published;
+
+  const Node& node(int i) const {
+    return chunks[i >> ChunkShift]->nodes[i & ChunkMask];
+  }
+
+  Node& writable(int i) {
+    // Copy node i's chunk before its first modification since the last publish
+    int c = i >> ChunkShift;
+    if (!chunk_is_private[c]) {
+      chunks[c] = std::make_shared<Chunk>(*chunks[c]);
+      chunk_is_private[c] = true;
+    }
+    return chunks[c]->nodes[i & ChunkMask];
+  }
+
+  void removeChildren(int i) {
+    // Free descendants children-first, as GenericTree_Nodeless does, so that
+    // slots are reused in the same order
+    std::vector<std::pair<int, int>> stack;   // (node, next child)
+    stack.push_back({ i, 0 });
+
+    while (!stack.empty()) {
+      std::pair<int, int> &fr = stack.back();
+      const std::vector<int> &ch = node(fr.first).children;
+
+      if (fr.second < int(ch.size())) {
+        int c = ch[fr.second++];
+        stack.push_back({ c, 0 });
+      }
+      else {
+        int j = fr.first;
+        stack.pop_back();
+        if (j != i) {
+          writable(j).live = false;
+          free_list.push_back(j);
+        }
+      }
+    }
+  }
+};
+
+
+#endif  // ifndef __GenericTree_Concurrent_h
@@ -0,0 +1,249 @@
+//
+// GenericTree_DiatomStream.h
+//
+// Streaming reads of trees saved as text in Diatom-Storage's format (see
+// example/tree.diatom), used by the trees' readDiatomFile() methods as an
+// alternative to loading the whole document and calling fromDiatom().
+//
+// - The file is read a line at a time. Each record of the tree's "tree" table
+//   is parsed into a small Diatom of its own, handed to the tree, and then
+//   discarded, so peak memory is the tree plus one record rather than the tree
+//   plus the whole document
+// - Entries outside the tree's table are skipped without being kept
+// - at is the dot-separated path of the tree's table in the document, e.g.
+//   "tree" for a document holding the tree under the key "tree", or "" if the
+//   document is the tree's table
+//
+// Lines are "key: value" or, for a table, "key:" followed by its entries,
+// indented further. Values are numbers, true or false, or strings, quoted or
+// not. Blank lines are ignored.
+//
+// MIT licensed: http://opensource.org/licenses/MIT
+//
+
+#ifndef __GenericTree_DiatomStream_h
+#define __GenericTree_DiatomStream_h
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <thread>
+
+
+template <class DiatomType>
+class GenericTree_DiatomStream {
+public:
+  template <class OnRecord, class OnFree>
+  static bool read(FILE *f, const char *at, OnRecord on_record, OnFree on_free) {
+    // Calls on_record(DiatomType &record) for each entry of the tree table, in
+    // file order, and on_free(int i) for each entry of the free list. Both
+    // return false to stop the read. Returns false if either does, on a read
+    // error or malformed line, or if the tree or free list table isn't found.
+    std::vector<std::string> path = splitPath(at);
+    int base = int(path.size());          // Depth of the tree's "tree" and "free_list"
+
+    struct Open {
+      int indent;
+      bool is_table;
+    };
+    std::vector<Open> open;               // The entries enclosing the current line
+    std::vector<std::string> keys;        // Their keys, by depth
+
+    enum { Other, Tree, FreeList } section = Other;
+    bool found_tree = false, found_free_list = false;
+    DiatomType record;
+    bool in_record = false;
+    std::vector<DiatomType*> record_tables;   // The record's open tables, by depth below it
+
+    std::string s;
+    while (readLine(f, s)) {
+      int indent = 0;
+      std::string key, value;
+      if (!parseLine(s, indent, key, value)) {
+        return false;
+      }
+      if (indent < 0) {
+        continue;    // Blank
+      }
+      bool is_table = value.empty();
+
+      while (!open.empty() && indent <= open.back().indent) {
+        open.pop_back();
+      }
+      if (!open.empty() && !open.back().is_table) {
+        return false;    // Indented below a value
+      }
+      int depth = int(open.size());
+      open.push_back({ indent, is_table });
+      keys.resize(depth);
+      keys.push_back(key);
+
+      // A record ends at the next line at or above its own depth
+      if (in_record && depth <= base + 1) {
+        in_record = false;
+        if (!on_record(record)) {
+          return false;
+        }
+      }
+
+      if (depth < base) {
+        continue;
+      }
+      if (depth == base) {
+        section = Other;
+        if (is_table && std::equal(path.begin(), path.end(), keys.begin())) {
+          if      (key == "tree")      { section = Tree;     found_tree = true;      }
+          else if (key == "free_list") { section = FreeList; found_free_list = true; }
+        }
+        continue;
+      }
+
+      if (section == FreeList && depth == base + 1) {
+        double x;
+        int i;
+        if (is_table || !parseNumber(value, x) || !toIndex(x, i)) {
+          return false;
+        }
+        if (!on_free(i)) {
+          return false;
+        }
+      }
+      else if (section == Tree && depth == base + 1) {
+        if (!is_table) {
+          return false;
+        }
+        record = DiatomType();
+        record_tables.assign(1, &record);
+        in_record = true;
+      }
+      else if (section == Tree) {
+        record_tables.resize(depth - base - 1);
+        DiatomType &d = (*record_tables.back())[key];
+        if (is_table) {
+          d = DiatomType();
+          record_tables.push_back(&d);
+        }
+        else {
+          d = scalar(value);
+        }
+      }
+    }
+
+    if (ferror(f) || (in_record && !on_record(record))) {
+      return false;
+    }
+    return found_tree && found_free_list;
+  }
+
+  static bool toIndex(double x, int &i) {
+    // x as a node index, or -1, if it is a whole number in range
+    if (!(x >= -1 && x <= 2147483647.0) || x != double(int(x))) {
+      return false;
+    }
+    i = int(x);
+    return true;
+  }
+
+  template <class Load, class Done>
+  static std::thread async(Load load, Done done) {
+    // Run load() on a new thread, then done(ok) on the same thread
+    return std::thread([load, done]() mutable {
+      done(load());
+    });
+  }
+
+private:
+  static std::vector<std::string> splitPath(const char *at) {
+    std::vector<std::string> path;
+    std::string cur;
+    for (const char *c = at; c && *c; ++c) {
+      if (*c == '.') { path.push_back(cur); cur.clear(); }
+      else           { cur += *c; }
+    }
+    if (!cur.empty() || !path.empty()) {
+      path.push_back(cur);
+    }
+    return path;
+  }
+
+  static bool readLine(FILE *f, std::string &s) {
+    s.clear();
+    char buf[4096];
+    while (fgets(buf, sizeof(buf), f)) {
+      s += buf;
+      if (!s.empty() && s.back() == '\n') {
+        return true;
+      }
+    }
+    return !s.empty();
+  }
+
+  static bool isSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+  }
+
+  static std::string trim(const std::string &s, size_t from, size_t to) {
+    while (from < to && isSpace(s[from]))   { ++from; }
+    while (to > from && isSpace(s[to - 1])) { --to;   }
+    return s.substr(from, to - from);
+  }
+
+  static bool parseLine(const std::string &s, int &indent, std::string &key, std::string &value) {
+    // indent is set to -1 for a blank line
+    size_t n = s.size();
+    size_t k = 0;
+    while (k < n && (s[k] == ' ' || s[k] == '\t')) {
+      ++k;
+    }
+    if (trim(s, k, n).empty()) {
+      indent = -1;
+      return true;
+    }
+
+    size_t colon = s.find(':', k);
+    if (colon == std::string::npos) {
+      return false;
+    }
+    indent = int(k);
+    key    = trim(s, k, colon);
+    value  = trim(s, colon + 1, n);
+    return !key.empty();
+  }
+
+  static bool parseNumber(const std::string &v, double &x) {
+    const char *c = v.c_str();
+    char *end = NULL;
+    x = strtod(c, &end);
+    return end != c && *end == '\0';
+  }
+
+  static DiatomType scalar(const std::string &v) {
+    double x;
+    if (v == "true")  { return DiatomType(true);  }
+    if (v == "false") { return DiatomType(false); }
+    if (parseNumber(v, x)) {
+      return DiatomType(x);
+    }
+
+    if (v.size() >= 2 && v.front() == '"' && v.back() == '"') {
+      std::string str;
+      for (size_t k = 1; k + 1 < v.size(); ++k) {
+        char c = v[k];
+        if (c == '\\' && k + 2 < v.size()) {
+          c = v[++k];
+          if      (c == 'n') { c = '\n'; }
+          else if (c == 't') { c = '\t'; }
+        }
+        str += c;
+      }
+      return DiatomType(str);
+    }
+    return DiatomType(v);
+  }
+};
+
+
+#endif  // ifndef __GenericTree_DiatomStream_h
@@ -0,0 +1,799 @@
+//
+// GenericTree_Fixed.h
+//
+// A version of GenericTree_Referential for trees with at most N children per
+// node, such as binary trees, quadtrees (N = 4) and octrees (N = 8).
+//
+// - Children are stored inline, as int children[N], so nodes make no
+//   allocations of their own, and loops over children have a constant trip
+//   count the compiler can unroll
+// - Children are positional: child k of a quadtree node can be its k'th
+//   quadrant, with -1 where a position is empty
+// - Payloads are held by value in one contiguous array, indexed as the nodes
+// - walk, walk_and_pass, compaction and serialization work as they do for
+//   GenericTree_Referential
+//
+// MIT licensed: http://opensource.org/licenses/MIT
+//
+
+#ifndef __GenericTree_Fixed_h
+#define __GenericTree_Fixed_h
+
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+
+#include "GenericTree_Binary.h"
+
+// Optionally enable serialization
+#ifdef _GTR_ENABLE_SERIALIZATION
+  #include "Diatom.h"
+#endif
+
+// Optionally disable asserts
+#ifdef _GTR_DISABLE_SAFETY_CHECKS
+  #define _assert(x)
+#else
+  #include <cassert>
+  #define _assert(x) assert(x)
+#endif
+
+#define __GTF_NOT_FOUND -1
+
+
+template <class T, int N>
+class GenericTree_Fixed {
+  static_assert(N >= 1, "GenericTree_Fixed needs room for at least one child per node");
+
+public:
+  static const int Arity = N;
+  typedef int ChildArray[N];
+
+  struct NodeInfo {
+    int index_of_parent;
+    ChildArray children;    // __GTF_NOT_FOUND where a position is empty
+  };
+
+  void reset() {
+    nodes.clear();
+    payloads.clear();
+    free_list.clear();
+    live_slots.clear();
+    i_root = __GTF_NOT_FOUND;
+  }
+
+  void reserve(size_t n) {
+    nodes.reserve(n);
+    payloads.reserve(n);
+    live_slots.reserve((n + 63) >> 6);
+  }
+
+  int addNode(const T &x, int parent_ind = __GTF_NOT_FOUND, int position = -1) {
+    return emplaceNode(parent_ind, position, x);
+  }
+
+  int addNode(T &&x, int parent_ind = __GTF_NOT_FOUND, int position = -1) {
+    return emplaceNode(parent_ind, position, std::move(x));
+  }
+
+  template <class... Args>
+  int emplaceNode(int parent_ind, int position, Args&&... args) {
+    // Add a node as child position of parent_ind, or at its first empty
+    // position if -1, with its payload constructed from args. A node added at
+    // the top takes the previous top node as its child at position (or 0).
+    if (parent_ind != __GTF_NOT_FOUND) {
+      _assert(parent_ind >= 0 && parent_ind < nodes.size() && slotIsLive(parent_ind));
+      if (position == -1) {
+        position = firstEmptyPosition(parent_ind);
+      }
+      _assert(position >= 0 && position < N);
+      _assert(nodes[parent_ind].children[position] == __GTF_NOT_FOUND);
+    }
+    else {
+      if (position == -1) {
+        position = 0;
+      }
+      _assert(position >= 0 && position < N);
+    }
+
+    int ind = -1;
+    if (free_list.size() > 0) {
+      ind = free_list.back();
+      free_list.pop_back();
+      nodes[ind] = blankNode(parent_ind);
+      payloads[ind] = T(std::forward<Args>(args)...);
+    }
+    else {
+      payloads.emplace_back(std::forward<Args>(args)...);
+      nodes.push_back(blankNode(parent_ind));
+      ind = int(nodes.size()) - 1;
+    }
+    setSlotLive(ind, true);
+
+    if (parent_ind != __GTF_NOT_FOUND) {
+      nodes[parent_ind].children[position] = ind;
+    }
+    else {
+      if (i_root != __GTF_NOT_FOUND) {
+        nodes[ind].children[position] = i_root;
+        nodes[i_root].index_of_parent = ind;
+      }
+      i_root = ind;
+    }
+
+    return ind;
+  }
+
+  void removeNode(int i, bool recursivelyRemoveChildren) {
+    // As for GenericTree_Referential: without recursivelyRemoveChildren, i's
+    // children are left as the tops of orphaned subtrees
+    _assert(i >= 0 && i < nodes.size() && slotIsLive(i));
+    freeSlot(i);
+
+    // An orphan's old parent may no longer list it
+    int i_parent = nodes[i].index_of_parent;
+    if (i_parent != __GTF_NOT_FOUND && slotIsLive(i_parent)) {
+      int k = positionInParent(i);
+      if (k != -1) {
+        nodes[i_parent].children[k] = __GTF_NOT_FOUND;
+      }
+    }
+    if (i == i_root) {
+      i_root = __GTF_NOT_FOUND;
+    }
+
+    if (recursivelyRemoveChildren) {
+      removeChildren(i);
+    }
+  }
+
+  void print() {
+    int i_top = indexOfTopNode();
+    if (i_top == __GTF_NOT_FOUND) {
+      printf("[Tree is empty]\n");
+    }
+    else {
+      printSubtree(i_top);
+    }
+
+    size_t n_fl = free_list.size();
+    printf("%lu %s on free list", n_fl, n_fl == 1 ? "entry" : "entries");
+    if (n_fl > 0) {
+      printf(" - ");
+      for (auto i : free_list) {
+        printf("%d ", i);
+      }
+    }
+    printf("\n\n");
+  }
+
+  template <class Functor>
+  void walk(Functor f, int i = -2, int indent = 0) {
+    if (i == -2) i = indexOfTopNode();
+    if (i == __GTF_NOT_FOUND) return;
+
+    traversePreorder(i, [&](int j, int depth) { f(payloads[j], j, indent + depth); });
+  }
+    // walk:           parents before children
+    // walk_postorder: children before parents
+    // walk_levelorder: breadth-first, level by level
+    // Children are visited in position order, skipping empty positions.
+
+  template <class Functor>
+  void walk_postorder(Functor f, int i = -2, int indent = 0) {
+    if (i == -2) i = indexOfTopNode();
+    if (i == __GTF_NOT_FOUND) return;
+
+    traversePostorder(i, [&](int j, int depth) { f(payloads[j], j, indent + depth); });
+  }
+
+  template <class Functor>
+  void walk_levelorder(Functor f, int i = -2, int indent = 0) {
+    if (i == -2) i = indexOfTopNode();
+    if (i == __GTF_NOT_FOUND) return;
+
+    traverseLevelorder(i, [&](int j, int depth) { f(payloads[j], j, indent + depth); });
+  }
+
+  template <class Functor, class Return>
+  void walk_and_pass(Functor f, const Return &r_parent, int i = -2) {
+    if (i == -2) i = indexOfTopNode();
+    if (i == __GTF_NOT_FOUND) return;
+
+    // In a pre-order walk, the most recently visited node at depth d-1 is the
+    // parent of the node being visited at depth d, so one stored return value
+    // per level is enough.
+    std::vector<Return> r_by_depth;
+
+    traversePreorder(i, [&](int j, int depth) {
+      const Return &r_in = depth == 0 ? r_parent : r_by_depth[depth - 1];
+      Return r = f(payloads[j], r_in, j);
+
+      if (depth < int(r_by_depth.size())) r_by_depth[depth] = r;
+      else                                r_by_depth.push_back(r);
+    });
+  }
+    // walk_and_pass:
+    // Walk, passing the return value of the functor to all of the element's children.
+
+  int indexOfTopNode() {
+    return i_root;
+  }
+
+  int parentOfNode(int i) {
+    _assert(i < nodes.size());
+    return nodes[i].index_of_parent;
+  }
+
+  int nChildren(int node_i) {
+    _assert(node_i < nodes.size());
+    int n = 0;
+    for (auto c : nodes[node_i].children) {
+      n += c != __GTF_NOT_FOUND;
+    }
+    return n;
+  }
+
+  const ChildArray& children(int node_i) {
+    // All N positions, __GTF_NOT_FOUND where empty
+    _assert(node_i < nodes.size());
+    return nodes[node_i].children;
+  }
+
+  int childAt(int node_i, int position) {
+    _assert(node_i < nodes.size());
+    _assert(position >= 0 && position < N);
+    return nodes[node_i].children[position];
+  }
+
+  int positionInParent(int i) {
+    // i's position in its parent's children, or -1 if it has no parent, or its
+    // parent no longer lists it
+    _assert(i < nodes.size());
+    int p = nodes[i].index_of_parent;
+    if (p == __GTF_NOT_FOUND) {
+      return -1;
+    }
+    for (int k=0; k < N; ++k) {
+      if (nodes[p].children[k] == i) {
+        return k;
+      }
+    }
+    return -1;
+  }
+
+  T& get(int i) {
+    _assert(i < nodes.size());
+    return payloads[i];
+  }
+
+  const T& get(int i) const {
+    _assert(i < nodes.size());
+    return payloads[i];
+  }
+
+  // Payload storage
+  // -----------------------------
+  // As for GenericTree_Referential, payloads are kept in one contiguous array,
+  // indexed by node index. The array includes free slots, whose payloads are
+  // stale - skip them with slotIsFree().
+
+  T* payloadData() {
+    return payloads.data();
+  }
+
+  const T* payloadData() const {
+    return payloads.data();
+  }
+
+  int nSlots() const {
+    return int(nodes.size());
+  }
+
+  bool slotIsFree(int i) {
+    _assert(i >= 0 && i < nodes.size());
+    return !slotIsLive(i);
+  }
+
+  bool isEmpty() {
+    return (nodes.size() == free_list.size());
+  }
+
+  // Compaction
+  // -----------------------------
+  // compact() removes free slots and renumbers the live nodes in pre-order, so
+  // that walks sweep the nodes vector sequentially. Subtrees orphaned by
+  // non-recursive removal are kept, numbered after the main tree. Children
+  // keep their positions.
+  //
+  // Returns a table mapping each old index to its new one (or -1 for a slot that
+  // was free).
+
+  std::vector<int> compact() {
+    std::vector<int> order;
+    collectLiveNodes(order);
+    return relayout(order);
+  }
+
+protected:
+  std::vector<NodeInfo> nodes;
+  std::vector<T> payloads;               // Indexed as nodes
+  std::vector<int> free_list;
+  int i_root = __GTF_NOT_FOUND;
+
+  static NodeInfo blankNode(int parent = __GTF_NOT_FOUND) {
+    NodeInfo node;
+    node.index_of_parent = parent;
+    for (auto &c : node.children) {
+      c = __GTF_NOT_FOUND;
+    }
+    return node;
+  }
+
+  int firstEmptyPosition(int i) {
+    for (int k=0; k < N; ++k) {
+      if (nodes[i].children[k] == __GTF_NOT_FOUND) {
+        return k;
+      }
+    }
+    return -1;
+  }
+
+  int findTopNode() {
+    // Find the top node by climbing from the first live slot
+    if (isEmpty()) {
+      return __GTF_NOT_FOUND;
+    }
+
+    int i_top = firstLiveSlot();
+    for (int k=0, n = int(nodes.size()); k < n && nodes[i_top].index_of_parent != __GTF_NOT_FOUND; ++k) {
+      i_top = nodes[i_top].index_of_parent;
+    }
+    return i_top;
+  }
+
+  void collectLiveNodes(std::vector<int> &order) {
+    // Live node indices in pre-order: the tree from the root, then any orphaned
+    // subtrees, each from its topmost live ancestor
+    std::vector<bool> seen(nodes.size(), false);
+    order.reserve(nodes.size() - free_list.size());
+
+    auto collect = [&](int i_top) {
+      traversePreorder(i_top, [&](int i, int depth) {
+        seen[i] = true;
+        order.push_back(i);
+      });
+    };
+
+    if (i_root != __GTF_NOT_FOUND) {
+      collect(i_root);
+    }
+    for (int i=0, n = int(nodes.size()); i < n; ++i) {
+      if (!slotIsLive(i) || seen[i]) {
+        continue;
+      }
+
+      int i_top = i;
+      while (true) {
+        int p = nodes[i_top].index_of_parent;
+        if (p == __GTF_NOT_FOUND || !slotIsLive(p) || seen[p] || positionInParent(i_top) == -1) {
+          break;
+        }
+        i_top = p;
+      }
+      collect(i_top);
+    }
+  }
+
+  std::vector<int> relayout(const std::vector<int> &order) {
+    // Rebuild the nodes vector with order[k] moved to index k. Every live node
+    // must appear in order exactly once. Parents are relinked from the child
+    // arrays.
+    std::vector<int> remap(nodes.size(), __GTF_NOT_FOUND);
+    for (int k=0, n = int(order.size()); k < n; ++k) {
+      remap[order[k]] = k;
+    }
+
+    std::vector<NodeInfo> relaid(order.size(), blankNode());
+    std::vector<T> relaid_payloads;
+    relaid_payloads.reserve(order.size());
+    for (int k=0, n = int(order.size()); k < n; ++k) {
+      relaid_payloads.push_back(std::move(payloads[order[k]]));
+      const NodeInfo &old = nodes[order[k]];
+      for (int c=0; c < N; ++c) {
+        if (old.children[c] != __GTF_NOT_FOUND) {
+          int j = remap[old.children[c]];
+          relaid[k].children[c] = j;
+          relaid[j].index_of_parent = k;
+        }
+      }
+    }
+
+    nodes.swap(relaid);
+    payloads.swap(relaid_payloads);
+    free_list.clear();
+    rebuildLiveSlots();
+    i_root = i_root == __GTF_NOT_FOUND ? __GTF_NOT_FOUND : remap[i_root];
+
+    return remap;
+  }
+
+  void removeChildren(int i) {
+    _assert(i < nodes.size());
+
+    // Free descendants children-first
+    traversePostorder(i, [&](int j, int depth) {
+      if (j != i) {
+        freeSlot(j);
+      }
+    });
+  }
+
+  void freeSlot(int i) {
+    setSlotLive(i, false);
+    free_list.push_back(i);
+  }
+
+  // Slot liveness
+  // -----------------------------
+  // One bit per slot in the nodes vector, set while the slot is in use, i.e.
+  // not in the free list. Lets membership checks run in O(1), and scans for
+  // live slots skip 64 dead slots at a time.
+
+  std::vector<uint64_t> live_slots;
+
+  void setSlotLive(int i, bool live) {
+    size_t w = size_t(i) >> 6;
+    if (w >= live_slots.size()) {
+      live_slots.resize(w + 1, 0);
+    }
+    uint64_t bit = uint64_t(1) << (i & 63);
+    if (live) { live_slots[w] |= bit;  }
+    else      { live_slots[w] &= ~bit; }
+  }
+
+  bool slotIsLive(int i) {
+    size_t w = size_t(i) >> 6;
+    return w < live_slots.size() && (live_slots[w] >> (i & 63)) & 1;
+  }
+
+  int firstLiveSlot() {
+    for (size_t w=0, n = live_slots.size(); w < n; ++w) {
+      uint64_t bits = live_slots[w];
+      if (bits) {
+        int b = 0;
+        while (!(bits & 1)) { bits >>= 1; ++b; }
+        return int(w << 6) + b;
+      }
+    }
+    return -1;
+  }
+
+  void rebuildLiveSlots() {
+    live_slots.assign((nodes.size() + 63) >> 6, 0);
+    for (int i=0, n = int(nodes.size()); i < n; ++i) {
+      setSlotLive(i, true);
+    }
+    for (auto i : free_list) {
+      setSlotLive(i, false);
+    }
+  }
+
+  void printSubtree(int i_top) {
+    traversePreorder(i_top, [&](int i, int indent) {
+      for (int j=0; j < indent; ++j) {
+        if (j == indent - 1) { printf("└──"); }
+        else                 { printf("   "); }
+      }
+
+      NodeInfo &n = nodes[i];
+
+      printf("☐  index: %d  ", i);
+      printf("children: ");
+      for (auto c : n.children) {
+        if (c == __GTF_NOT_FOUND) { printf("- "); }
+        else                      { printf("%d ", c); }
+      }
+      printf(" parent: ");
+      if (n.index_of_parent == __GTF_NOT_FOUND) { printf("[none]"); }
+      else                                      { printf("%d", n.index_of_parent); }
+      printf("\n");
+    });
+  }
+
+  // Traversal
+  // -----------------------------
+  // visit(i, depth) is called for each node in the subtree at i. Walks use an
+  // explicit stack (or queue), so deep trees can't overflow the call stack.
+  // The stack's storage is kept between walks, one per thread, so walks of a
+  // tree from several threads at once don't share it. A walk started from
+  // within a visitor swaps it out and uses its own, so nested walks are safe.
+
+  struct WalkFrame {
+    int i;
+    int depth;
+    int next_child;
+  };
+
+  static std::vector<WalkFrame>& walkStack() {
+    static thread_local std::vector<WalkFrame> stack;
+    return stack;
+  }
+
+  template <class Visitor>
+  void traversePreorder(int i_start, Visitor visit) {
+    std::vector<WalkFrame> stack;
+    stack.swap(walkStack());
+    stack.push_back({ i_start, 0, 0 });
+
+    while (!stack.empty()) {
+      WalkFrame fr = stack.back();
+      stack.pop_back();
+      visit(fr.i, fr.depth);
+
+      const ChildArray &children = nodes[fr.i].children;
+      for (int c = N - 1; c >= 0; --c) {
+        if (children[c] != __GTF_NOT_FOUND) {
+          stack.push_back({ children[c], fr.depth + 1, 0 });
+        }
+      }
+    }
+
+    walkStack().swap(stack);
+  }
+
+  template <class Visitor>
+  void traversePostorder(int i_start, Visitor visit) {
+    std::vector<WalkFrame> stack;
+    stack.swap(walkStack());
+    stack.push_back({ i_start, 0, 0 });
+
+    while (!stack.empty()) {
+      WalkFrame &fr = stack.back();
+      const ChildArray &children = nodes[fr.i].children;
+
+      while (fr.next_child < N && children[fr.next_child] == __GTF_NOT_FOUND) {
+        ++fr.next_child;
+      }
+
+      if (fr.next_child < N) {
+        int c     = children[fr.next_child++];
+        int depth = fr.depth + 1;
+        stack.push_back({ c, depth, 0 });
+      }
+      else {
+        WalkFrame done = fr;
+        stack.pop_back();
+        visit(done.i, done.depth);
+      }
+    }
+
+    walkStack().swap(stack);
+  }
+
+  template <class Visitor>
+  void traverseLevelorder(int i_start, Visitor visit) {
+    std::vector<WalkFrame> queue;
+    queue.swap(walkStack());
+    queue.push_back({ i_start, 0, 0 });
+
+    for (size_t head = 0; head < queue.size(); ++head) {
+      WalkFrame fr = queue[head];
+      visit(fr.i, fr.depth);
+
+      for (auto c : nodes[fr.i].children) {
+        if (c != __GTF_NOT_FOUND) {
+          queue.push_back({ c, fr.depth + 1, 0 });
+        }
+      }
+    }
+
+    queue.clear();
+    walkStack().swap(queue);
+  }
+
+public:
+
+  // Binary snapshots
+  // -----------------------------
+  // As for GenericTree_Referential - see GenericTree_Binary.h. The children
+  // section lists each node's non-empty positions in order, and the
+  // HasChildPositions section gives the position of each.
+  //
+  // readBinary() returns false if the snapshot is truncated or malformed, or
+  // has more than N children per node, leaving the tree unchanged.
+
+  struct RawCodec {
+    bool write(FILE *f, const T &x) {
+      static_assert(std::is_trivially_copyable<T>::value, "RawCodec requires a trivially copyable T");
+      return fwrite(&x, sizeof(T), 1, f) == 1;
+    }
+    bool read(FILE *f, T &x) {
+      static_assert(std::is_trivially_copyable<T>::value, "RawCodec requires a trivially copyable T");
+      return fread(&x, sizeof(T), 1, f) == 1;
+    }
+  };
+
+  template <class Codec = RawCodec>
+  bool writeBinary(FILE *f, Codec codec = Codec()) {
+    std::vector<int32_t> positions;
+    bool ok = GenericTree_Binary::writeStructure(
+      f, GenericTree_Binary::HasPayloads | GenericTree_Binary::HasChildPositions,
+      int(nodes.size()), i_root, free_list,
+      [&](int i) { return slotIsLive(i); },
+      [&](int i) { return nodes[i].index_of_parent; },
+      [&](int i, std::vector<int32_t> &out) {
+        for (int k=0; k < N; ++k) {
+          if (nodes[i].children[k] != __GTF_NOT_FOUND) {
+            out.push_back(nodes[i].children[k]);
+            positions.push_back(k);
+          }
+        }
+      }
+    );
+
+    ok = ok && GenericTree_Binary::writeInts(f, positions.data(), positions.size());
+    for (int i=0, n = int(nodes.size()); ok && i < n; ++i) {
+      if (slotIsLive(i))
+        ok = codec.write(f, payloads[i]);
+    }
+    return ok;
+  }
+
+  template <class Codec = RawCodec>
+  bool readBinary(FILE *f, Codec codec = Codec()) {
+    GenericTree_BinaryStructure s;
+    uint32_t needed = GenericTree_Binary::HasPayloads | GenericTree_Binary::HasChildPositions;
+    if (!GenericTree_Binary::readStructure(f, s) || (s.header.flags & needed) != needed) {
+      return false;
+    }
+
+    std::vector<int32_t> positions;
+    if (!GenericTree_Binary::readInts(f, positions, s.header.n_child_entries)) {
+      return false;
+    }
+
+    int n = s.header.n_nodes;
+    std::vector<NodeInfo> loaded(n, blankNode());
+    std::vector<T> loaded_payloads(n);
+    for (int i=0; i < n; ++i) {
+      loaded[i].index_of_parent = s.parent[i];
+      for (int e = s.childrenBegin(i); e < s.childrenEnd(i); ++e) {
+        int k = positions[e];
+        if (k < 0 || k >= N || loaded[i].children[k] != __GTF_NOT_FOUND) {
+          return false;
+        }
+        loaded[i].children[k] = s.children[e];
+      }
+    }
+
+    // Payloads, for live slots
+    std::vector<bool> is_free(n, false);
+    for (auto i : s.free_list)
+      is_free[i] = true;
+    for (int i=0; i < n; ++i) {
+      if (!is_free[i] && !codec.read(f, loaded_payloads[i]))
+        return false;
+    }
+
+    reset();
+    nodes.swap(loaded);
+    payloads.swap(loaded_payloads);
+    free_list.assign(s.free_list.begin(), s.free_list.end());
+
+    rebuildLiveSlots();
+    i_root = s.header.root;
+    return true;
+  }
+
+  template <class Codec = RawCodec>
+  bool writeBinary(const char *path, Codec codec = Codec()) {
+    FILE *f = fopen(path, "wb");
+    if (!f)
+      return false;
+    bool ok = writeBinary(f, codec);
+    return fclose(f) == 0 && ok;
+  }
+
+  template <class Codec = RawCodec>
+  bool readBinary(const char *path, Codec codec = Codec()) {
+    FILE *f = fopen(path, "rb");
+    if (!f)
+      return false;
+    bool ok = readBinary(f, codec);
+    fclose(f);
+    return ok;
+  }
+
+#ifdef _GTR_ENABLE_SERIALIZATION
+
+  // Serialization
+  // -----------------------------
+  // As for GenericTree_Referential: _toDiatom() and _fromDiatom() functions
+  // must be defined for the node type, before GenericTree_Fixed is #included.
+  // Each node's child_inds lists all N positions, with -1 where empty.
+
+  Diatom toDiatom() {
+    Diatom d;
+
+    // Tree
+    {
+      d["tree"] = Diatom();
+
+      for (int i=0, n_nodes = int(nodes.size()); i < n_nodes; ++i) {
+        const NodeInfo &n = nodes[i];
+        Diatom &d_node = d["tree"][srlz_index(i)] = Diatom();
+
+        d_node["node"] = _toDiatom(payloads[i]);
+        d_node["parent_ind"] = (double) n.index_of_parent;
+        Diatom &dch = d_node["child_inds"] = Diatom();
+        for (int k=0; k < N; ++k)
+          dch[srlz_index(k)] = (double) n.children[k];
+      }
+    }
+
+    // Free list
+    {
+      d["free_list"] = Diatom();
+      int i = 0;
+      for (auto ind : free_list)
+        d["free_list"][srlz_index(i++)] = (double) ind;
+    }
+
+    return d;
+  }
+
+  void fromDiatom(Diatom &d) {
+    _assert(d.is_table());
+    reset();
+
+    Diatom &d_tree      = d["tree"];
+    Diatom &d_free_list = d["free_list"];
+    _assert(d_tree.is_table());
+    _assert(d_free_list.is_table());
+
+    // Tree
+    d_tree.each([&](std::string &key, Diatom &dn) {
+      Diatom &d_node       = dn["node"];
+      Diatom &d_parent_ind = dn["parent_ind"];
+      Diatom &d_child_inds = dn["child_inds"];
+
+      _assert(d_parent_ind.is_number());
+      _assert(d_child_inds.is_table());
+
+      NodeInfo n = blankNode((int) d_parent_ind.number_value());
+
+      int k = 0;
+      d_child_inds.each([&](std::string &ch_key, Diatom &dc) {
+        _assert(dc.is_number());
+        _assert(k < N);
+        n.children[k++] = (int) dc.number_value();
+      });
+
+      nodes.push_back(n);
+      payloads.push_back(_fromDiatom(d_node));
+    });
+
+    // Free list
+    d_free_list.each([&](std::string, Diatom &li) {
+      _assert(li.is_number());
+      free_list.push_back((int) li.number_value());
+    });
+
+    rebuildLiveSlots();
+    i_root = findTopNode();
+  }
+
+private:
+  static std::string srlz_index(int i) {
+    return std::string("n") + std::to_string(i);
+  }
+
+#endif
+
+};
+
+
+#endif  // ifndef __GenericTree_Fixed_h
@@ -0,0 +1,173 @@
+//
+// GenericTree_Journal.h
+//
+// An append-only log of the changes made to a tree, for saving in proportion
+// to the volume of edits rather than to the size of the tree. Used by
+// GenericTree_Nodeless (with _GT_ENABLE_JOURNAL) and GenericTree_Referential
+// (with _GTR_ENABLE_JOURNAL):
+//
+//  - setJournal() gives the tree a journal, into which it records each
+//    addNode, removeNode, moveSubtree, batch and compaction, by node index
+//  - writeJournal() appends the records so far to a file as one chunk, and
+//    clears them
+//  - replayJournal() applies a file's chunks to a tree loaded from the snapshot
+//    the journal was started after (see GenericTree_Binary.h). Slot reuse is
+//    deterministic, so replayed nodes get the indices they were recorded with,
+//    and a record whose index doesn't match fails the replay.
+//  - to fold a journal into a new snapshot, write the tree with writeBinary()
+//    and start a new, empty journal file. Offline, readBinary() the old
+//    snapshot, replayJournal() and writeBinary().
+//
+// Operations which replace the whole tree (reset, readBinary, fromDiatom,
+// buildFromParentArray) are not recorded: write a new snapshot after them.
+//
+// File layout: a sequence of chunks, each
+//  - a 16-byte GenericTree_JournalChunkHeader
+//  - GenericTree_JournalRecord records[n_records]
+//  - if the HasPayloads flag is set, a payload for each Add or SetPayload
+//    record, in record order, as written by a codec (GenericTree_Referential).
+//    Payloads are those current when the chunk is written, read from the slot
+//    each node occupies by then (see payloadSlots()), which gives the same final
+//    tree, as a node's later payloads overwrite its earlier ones. A node
+//    removed since has no payload, and a default T is written in its place.
+//
+// Values are in the writer's native byte order.
+//
+// MIT licensed: http://opensource.org/licenses/MIT
+//
+
+#ifndef __GenericTree_Journal_h
+#define __GenericTree_Journal_h
+
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+
+
+struct GenericTree_JournalRecord {
+  int32_t op;
+  int32_t i;     // The node
+  int32_t a;     // Add, Move: the parent. Remove: whether recursive.
+  int32_t b;     // Move: the position
+};
+
+
+struct GenericTree_JournalChunkHeader {
+  char     magic[4];
+  uint32_t version;
+  uint32_t flags;
+  int32_t  n_records;
+};
+
+
+class GenericTree_Journal {
+public:
+  static const uint32_t Version = 1;
+
+  enum Op {
+    Add = 1,
+    Remove,
+    Move,
+    SetPayload,
+    BeginBatch,
+    Commit,
+    Compact,
+    RelayoutLevelOrder,
+  };
+
+  enum Flags {
+    HasPayloads = 1,
+  };
+
+  static const char* magic() {
+    return "GTJ1";
+  }
+
+  void add(int i, int parent)                    { push(Add, i, parent, 0); payload_slots.push_back(i); }
+  void remove(int i, bool recursive)             { push(Remove, i, recursive, 0); }
+  void move(int i, int new_parent, int position) { push(Move, i, new_parent, position); }
+  void setPayload(int i)                         { push(SetPayload, i, 0, 0); payload_slots.push_back(i); }
+  void beginBatch()                              { push(BeginBatch, -1, 0, 0); }
+  void commit()                                  { push(Commit, -1, 0, 0); }
+  void compact()                                 { push(Compact, -1, 0, 0); }
+  void relayoutLevelOrder()                      { push(RelayoutLevelOrder, -1, 0, 0); }
+
+  const std::vector<GenericTree_JournalRecord>& records() const {
+    return recs;
+  }
+
+  const std::vector<int>& payloadSlots() const {
+    // For each Add or SetPayload record, in order, the slot its node now
+    // occupies, or -1 if it has since been removed by a compaction
+    return payload_slots;
+  }
+
+  void remapPayloadSlots(const std::vector<int> &remap) {
+    // Follow the renumbering made by a compaction
+    for (auto &i : payload_slots) {
+      i = i >= 0 && i < int(remap.size()) ? remap[i] : -1;
+    }
+  }
+
+  bool empty() const {
+    return recs.empty();
+  }
+
+  void clear() {
+    recs.clear();
+    payload_slots.clear();
+  }
+
+  static bool hasPayload(const GenericTree_JournalRecord &r) {
+    return r.op == Add || r.op == SetPayload;
+  }
+
+
+  // Chunks
+  // -----------------------------
+  // writeChunk() writes the header and records, after which the tree writes
+  // any payloads. readChunk() returns false at the end of the file, or if the
+  // chunk is truncated or malformed - at_end distinguishes the two.
+
+  bool writeChunk(FILE *f, uint32_t flags) const {
+    GenericTree_JournalChunkHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, magic(), 4);
+    h.version   = Version;
+    h.flags     = flags;
+    h.n_records = (int32_t) recs.size();
+
+    return fwrite(&h, sizeof(h), 1, f) == 1 &&
+           (recs.empty() || fwrite(recs.data(), sizeof(GenericTree_JournalRecord), recs.size(), f) == recs.size());
+  }
+
+  static bool readChunk(FILE *f, GenericTree_JournalChunkHeader &h,
+                        std::vector<GenericTree_JournalRecord> &records, bool &at_end) {
+    at_end = false;
+    size_t got = fread(&h, 1, sizeof(h), f);
+    if (got == 0 && feof(f)) {
+      at_end = true;
+      return false;
+    }
+    if (got != sizeof(h) || memcmp(h.magic, magic(), 4) != 0 ||
+        h.version != Version || h.n_records < 0) {
+      return false;
+    }
+
+    records.resize(h.n_records);
+    return h.n_records == 0 ||
+           fread(records.data(), sizeof(GenericTree_JournalRecord), h.n_records, f) == size_t(h.n_records);
+  }
+
+private:
+  std::vector<GenericTree_JournalRecord> recs;
+  std::vector<int> payload_slots;
+
+  void push(int op, int i, int a, int b) {
+    recs.push_back({ op, i, a, b });
+  }
+};
+
+
+#endif  // ifndef __GenericTree_Journal_h
@@ -0,0 +1,902 @@
+//
+// GenericTree_Linked.h
+//
+// - A version of GenericTree_Nodeless which stores child lists as intrusive
+//   first-child/next-sibling links, rather than a std::vector per node
+// - Each node is 16 bytes, and adding a node makes no allocations beyond growing
+//   the nodes vector
+// - Walks follow the links directly and need no stack
+// - Siblings are doubly linked, so removing a child is O(1) and keeps the order
+//   of the others. The first child's prev_sibling link is to the last child,
+//   which keeps nodes at 16 bytes.
+// - As with GenericTree_Nodeless, node payloads live in an externally-managed vector
+//   at the same index as the node (see addNodeAndInsert), so this can stand in for
+//   the templated trees too
+// - nChildren() and indexForChild() are O(number of children) - to iterate over
+//   children, use firstChild() and nextSibling()
+//
+// MIT licensed: http://opensource.org/licenses/MIT
+//
+
+#ifndef __GenericTree_Linked_h
+#define __GenericTree_Linked_h
+
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+
+#include "GenericTree_Binary.h"
+
+// Optionally enable serialization
+#ifdef _GT_ENABLE_SERIALIZATION
+  #include "Diatom/Diatom.h"
+#endif
+
+// Optionally disable asserts
+#ifdef _GT_DISABLE_SAFETY_CHECKS
+  #define _assert(x)
+#else
+  #include <cassert>
+  #define _assert(x) assert(x)
+#endif
+
+
+class GenericTree_Linked {
+public:
+  struct Node {
+    int parent;
+    int first_child;
+    int next_sibling;
+    int prev_sibling;   // The last sibling, for a first child; -1 if not in a child list
+  };
+
+  struct ChildIterator {
+    const Node *nodes;
+    int i;
+
+    int operator*() const { return i; }
+    ChildIterator& operator++() { i = nodes[i].next_sibling; return *this; }
+    bool operator==(const ChildIterator &other) const { return i == other.i; }
+    bool operator!=(const ChildIterator &other) const { return i != other.i; }
+  };
+
+  struct ChildRange {
+    // A view of a node's children, following the sibling links
+    const Node *nodes;
+    int first;
+
+    ChildIterator begin() const { return { nodes, first }; }
+    ChildIterator end()   const { return { nodes, -1 }; }
+    bool empty() const { return first == -1; }
+  };
+
+  void reset() {
+    nodes.clear();
+    free_list.clear();
+    live_slots.clear();
+    root = -1;
+  }
+
+  void reserve(size_t n) {
+    nodes.reserve(n);
+    live_slots.reserve((n + 63) >> 6);
+  }
+
+  // Bulk construction
+  // -----------------------------
+  // Build the tree from an array of n parent indices, where parent[i] is the
+  // index of node i's parent, or -1 for the root. Node i gets index i, and
+  // children are ordered by index.
+  //  - fails, leaving the tree empty, unless there is exactly one root and every
+  //    node is reachable from it
+
+  bool buildFromParentArray(const int *parent, size_t n) {
+    reset();
+    if (n == 0) {
+      return true;
+    }
+
+    // Pass 1: validate parents & count children
+    std::vector<int> n_children(n, 0);
+    int i_top = -1;
+
+    for (int i=0; i < int(n); ++i) {
+      int p = parent[i];
+      if (p == -1) {
+        if (i_top != -1) {
+          return false;    // More than one root
+        }
+        i_top = i;
+      }
+      else if (p < 0 || p >= int(n) || p == i) {
+        return false;
+      }
+      else {
+        ++n_children[p];
+      }
+    }
+    if (i_top == -1) {
+      return false;
+    }
+
+    // Pass 2: link
+    Node empty = { -1, -1, -1, -1 };
+    nodes.assign(n, empty);
+    for (int i=0; i < int(n); ++i) {
+      if (parent[i] != -1) {
+        appendChild(parent[i], i);
+      }
+    }
+
+    rebuildLiveSlots();
+    root = i_top;
+
+    // Every node must be reachable from the root, otherwise the parent array
+    // contains a cycle
+    int n_reached = 0;
+    traversePreorder(i_top, [&](int i, int depth) { ++n_reached; });
+    if (n_reached != int(n)) {
+      reset();
+      return false;
+    }
+
+    return true;
+  }
+
+  static GenericTree_Linked fromParentArray(const int *parent, size_t n) {
+    GenericTree_Linked t;
+    bool ok = t.buildFromParentArray(parent, n);
+    _assert(ok);
+    return t;
+  }
+
+  int addNode(int parent) {
+    Node node = { parent, -1, -1, -1 };
+
+    // Return an index for the caller to use to add the node to the externally-managed vector.
+    int i = -1;
+    int i__prev_top = root;
+
+    if (free_list.size() > 0) {
+      i = free_list.back();
+      free_list.pop_back();
+
+      detachOrphans(i);
+      nodes[i] = node;
+    }
+    else {
+      i = (int) nodes.size();
+      nodes.push_back(node);
+    }
+    setSlotLive(i, true);
+
+    // Add node to parent's children
+    if (parent != -1) {
+      appendChild(parent, i);
+    }
+
+    // Or if the node is being inserted at the top, deal with current
+    // top node (if present)
+    else {
+      if (i__prev_top != -1) {
+        appendChild(i, i__prev_top);
+      }
+      root = i;
+    }
+
+    return i;
+  }
+
+  template<class T>
+  int addNodeAndInsert(int parent, T item, std::vector<T> &ext_nodes) {
+    int i = addNode(parent);
+
+    if (i == ext_nodes.size()) {
+      ext_nodes.push_back(item);
+    }
+    else {
+      ext_nodes[i] = item;
+    }
+
+    return i;
+  }
+
+  void removeNode(int i, bool recursively_remove_children) {
+    _assert(i >= 0 && i < nodes.size());
+    _assert(slotIsLive(i));
+
+    free_list.push_back(i);
+    setSlotLive(i, false);
+
+    if (nodes[i].parent != -1) {
+      unmakeChild(nodes[i].parent, i);
+    }
+    if (i == root) {
+      root = -1;
+    }
+
+    if (recursively_remove_children) {
+      removeChildren(i);
+    }
+  }
+
+  int firstChild(int i) {
+    return nodes[i].first_child;
+  }
+
+  int nextSibling(int i) {
+    return nodes[i].next_sibling;
+  }
+
+  ChildRange children(int i) {
+    _assert(i >= 0 && i < nodes.size());
+    return { nodes.data(), nodes[i].first_child };
+  }
+
+  int indexForChild(int parent, int child_in_children_list) {
+    _assert(parent >= 0 && parent < nodes.size());
+    _assert(child_in_children_list >= 0);
+
+    int c = nodes[parent].first_child;
+    for (int k=0; k < child_in_children_list && c != -1; ++k) {
+      c = nodes[c].next_sibling;
+    }
+
+    _assert(c != -1);
+    return c;
+  }
+
+  void print() {
+    int i_top = indexOfTopNode();
+    if (i_top == -1) {
+      printf("[Tree is empty]\n");
+    }
+    else {
+      printSubtree(i_top);
+    }
+
+    size_t n_fl = free_list.size();
+    printf("%lu %s on free list", n_fl, n_fl == 1 ? "entry" : "entries");
+    if (n_fl > 0) {
+      printf(" - ");
+      for (int &i : free_list) {
+        printf("%d ", i);
+      }
+    }
+    printf("\n\n");
+  }
+
+  template <class Functor>
+  void walk(Functor f, int i = -2) {
+    if (i == -2) {
+      i = indexOfTopNode();
+    }
+
+    if (i == -1) {
+      return;
+    }
+
+    traversePreorder(i, [&](int j, int depth) { f(j); });
+  }
+    // walk:           parents before children
+    // walk_postorder: children before parents
+    // walk_levelorder: breadth-first, level by level
+
+  template <class Functor>
+  void walk_postorder(Functor f, int i = -2) {
+    if (i == -2) {
+      i = indexOfTopNode();
+    }
+
+    if (i == -1) {
+      return;
+    }
+
+    traversePostorder(i, [&](int j, int depth) { f(j); });
+  }
+
+  template <class Functor>
+  void walk_levelorder(Functor f, int i = -2) {
+    if (i == -2) {
+      i = indexOfTopNode();
+    }
+
+    if (i == -1) {
+      return;
+    }
+
+    traverseLevelorder(i, [&](int j, int depth) { f(j); });
+  }
+
+  // Reduction
+  // -----------------------------
+  // Fold the subtree at i bottom-up, writing a value for each of its nodes into
+  // out, which is indexed by node index and so must have an entry for each
+  // index in the subtree:
+  //    out[j] = combineFn(...combineFn(leafFn(j), out[c0])..., out[cn])
+  // for j's children c0...cn, in order. Nothing else is allocated.
+  //  - leafFn(j) -> Value
+  //  - combineFn(const Value &acc, const Value &child) -> Value
+
+  template <class Value, class LeafFn, class CombineFn>
+  void reduce(Value *out, LeafFn leafFn, CombineFn combineFn, int i = -2) {
+    if (i == -2) {
+      i = indexOfTopNode();
+    }
+
+    if (i == -1) {
+      return;
+    }
+
+    traversePostorder(i, [&](int j, int depth) {
+      Value v = leafFn(j);
+      for (int c = nodes[j].first_child; c != -1; c = nodes[c].next_sibling) {
+        v = combineFn(v, out[c]);
+      }
+      out[j] = v;
+    });
+  }
+
+  int indexOfTopNode() {
+    return root;
+  }
+
+  int nChildren(int i) {
+    int n = 0;
+    for (int c = nodes[i].first_child; c != -1; c = nodes[c].next_sibling) {
+      ++n;
+    }
+    return n;
+  }
+
+  int parentIndex(int i) {
+    return nodes[i].parent;
+  }
+
+  bool isEmpty() {
+    return nodes.size() == free_list.size();
+  }
+
+  // Compaction
+  // -----------------------------
+  // compact() removes free slots and renumbers the live nodes in pre-order, so
+  // that walks sweep the nodes vector sequentially. Subtrees orphaned by
+  // non-recursive removal are kept, numbered after the main tree.
+  //
+  // Returns a table mapping each old index to its new one (or -1 for a slot that
+  // was free). Use applyRemap() to permute an externally-managed vector
+  // (such as the one used with addNodeAndInsert) to match.
+
+  std::vector<int> compact() {
+    std::vector<int> order;
+    collectLiveNodes(order);
+    return relayout(order);
+  }
+
+  template<class T>
+  static void applyRemap(const std::vector<int> &remap, std::vector<T> &ext_nodes) {
+    _assert(ext_nodes.size() >= remap.size());
+
+    std::vector<int> old_index;
+    for (int i=0, n = int(remap.size()); i < n; ++i) {
+      if (remap[i] != -1) {
+        if (old_index.size() <= remap[i]) {
+          old_index.resize(remap[i] + 1, -1);
+        }
+        old_index[remap[i]] = i;
+      }
+    }
+
+    std::vector<T> relaid;
+    relaid.reserve(old_index.size());
+    for (auto i : old_index) {
+      relaid.push_back(std::move(ext_nodes[i]));
+    }
+    ext_nodes.swap(relaid);
+  }
+
+protected:
+  std::vector<Node> nodes;
+  std::vector<int> free_list;
+  int root = -1;
+
+  int findTopNode() {
+    // Find the top node by climbing from the first live slot
+    if (isEmpty()) {
+      return -1;
+    }
+
+    int i_top = firstLiveSlot();
+    while (nodes[i_top].parent != -1) {
+      i_top = nodes[i_top].parent;
+    }
+
+    return i_top;
+  }
+
+  void collectLiveNodes(std::vector<int> &order) {
+    // Live node indices in pre-order: the tree from the root, then any orphaned
+    // subtrees, each from its topmost live ancestor
+    std::vector<bool> seen(nodes.size(), false);
+    order.reserve(nodes.size() - free_list.size());
+
+    auto collect = [&](int i_top) {
+      traversePreorder(i_top, [&](int i, int depth) {
+        seen[i] = true;
+        order.push_back(i);
+      });
+    };
+
+    if (root != -1) {
+      collect(root);
+    }
+    for (int i=0, n = int(nodes.size()); i < n; ++i) {
+      if (!slotIsLive(i) || seen[i]) {
+        continue;
+      }
+
+      int i_top = i;
+      while (true) {
+        int p = nodes[i_top].parent;
+        if (p == -1 || !slotIsLive(p) || seen[p] || !nodeListsChild(p, i_top)) {
+          break;
+        }
+        i_top = p;
+      }
+      collect(i_top);
+    }
+  }
+
+  std::vector<int> relayout(const std::vector<int> &order) {
+    // Rebuild the nodes vector with order[k] moved to index k. Every live node
+    // must appear in order exactly once.
+    std::vector<int> remap(nodes.size(), -1);
+    for (int k=0, n = int(order.size()); k < n; ++k) {
+      remap[order[k]] = k;
+    }
+
+    Node empty = { -1, -1, -1, -1 };
+    std::vector<Node> relaid(order.size(), empty);
+    for (int k=0, n = int(order.size()); k < n; ++k) {
+      for (int c = nodes[order[k]].first_child; c != -1; c = nodes[c].next_sibling) {
+        appendChild(relaid, k, remap[c]);
+      }
+    }
+
+    nodes.swap(relaid);
+    free_list.clear();
+    rebuildLiveSlots();
+    root = root == -1 ? -1 : remap[root];
+
+    return remap;
+  }
+
+  bool nodeListsChild(int parent, int child) {
+    return nodes[child].parent == parent && nodes[child].prev_sibling != -1;
+  }
+
+  void removeChildren(int i) {
+    _assert(i < nodes.size());
+
+    // Free descendants children-first
+    traversePostorder(i, [&](int j, int depth) {
+      if (j != i) {
+        free_list.push_back(j);
+        setSlotLive(j, false);
+      }
+    });
+  }
+
+  bool nodeIsPresent(int i) {
+    return i != -1 && !indexIsInFreeList(i);
+  }
+
+  bool indexIsInFreeList(int i) {
+    return !slotIsLive(i);
+  }
+
+  void appendChild(int parent, int child) {
+    appendChild(nodes, parent, child);
+  }
+
+  static void appendChild(std::vector<Node> &nodes, int parent, int child) {
+    Node &p = nodes[parent];
+    Node &c = nodes[child];
+
+    c.parent       = parent;
+    c.next_sibling = -1;
+
+    if (p.first_child == -1) {
+      p.first_child  = child;
+      c.prev_sibling = child;
+    }
+    else {
+      int last = nodes[p.first_child].prev_sibling;
+      nodes[last].next_sibling = child;
+      c.prev_sibling = last;
+      nodes[p.first_child].prev_sibling = child;
+    }
+  }
+
+  void unmakeChild(int parent, int child_to_remove) {
+    _assert(parent >= 0 && parent < nodes.size());
+    _assert(child_to_remove >= 0 && child_to_remove < nodes.size());
+
+    Node &p = nodes[parent];
+    Node &c = nodes[child_to_remove];
+
+    // Nothing to do if the child isn't listed by parent (see detachOrphans)
+    if (c.parent != parent || c.prev_sibling == -1 || p.first_child == -1) {
+      return;
+    }
+
+    int prev = c.prev_sibling;
+    int next = c.next_sibling;
+
+    if (child_to_remove == p.first_child) {
+      p.first_child = next;
+      if (next != -1) { nodes[next].prev_sibling = prev; }
+    }
+    else {
+      nodes[prev].next_sibling = next;
+      if (next != -1) { nodes[next].prev_sibling = prev; }
+      else            { nodes[p.first_child].prev_sibling = prev; }
+    }
+
+    c.next_sibling = -1;
+    c.prev_sibling = -1;
+  }
+
+  void detachOrphans(int i) {
+    // Before free slot i is reused: children left in its list by non-recursive
+    // removal keep i as their (stale) parent, as in GenericTree_Nodeless, but
+    // must not appear to be listed by the new node at i
+    for (int c = nodes[i].first_child; c != -1; ) {
+      if (!slotIsLive(c) || nodes[c].parent != i) {
+        break;
+      }
+      int next = nodes[c].next_sibling;
+      nodes[c].next_sibling = -1;
+      nodes[c].prev_sibling = -1;
+      c = next;
+    }
+  }
+
+  // Slot liveness
+  // -----------------------------
+  // One bit per slot in the nodes vector, set while the slot is in use, i.e.
+  // not in the free list. Lets membership checks run in O(1), and scans for
+  // live slots skip 64 dead slots at a time.
+
+  std::vector<uint64_t> live_slots;
+
+  void setSlotLive(int i, bool live) {
+    size_t w = size_t(i) >> 6;
+    if (w >= live_slots.size()) {
+      live_slots.resize(w + 1, 0);
+    }
+    uint64_t bit = uint64_t(1) << (i & 63);
+    if (live) { live_slots[w] |= bit;  }
+    else      { live_slots[w] &= ~bit; }
+  }
+
+  bool slotIsLive(int i) {
+    size_t w = size_t(i) >> 6;
+    return w < live_slots.size() && (live_slots[w] >> (i & 63)) & 1;
+  }
+
+  int firstLiveSlot() {
+    for (size_t w=0, n = live_slots.size(); w < n; ++w) {
+      uint64_t bits = live_slots[w];
+      if (bits) {
+        int b = 0;
+        while (!(bits & 1)) { bits >>= 1; ++b; }
+        return int(w << 6) + b;
+      }
+    }
+    return -1;
+  }
+
+  void rebuildLiveSlots() {
+    live_slots.assign((nodes.size() + 63) >> 6, 0);
+    for (int i=0, n = int(nodes.size()); i < n; ++i) {
+      setSlotLive(i, true);
+    }
+    for (auto i : free_list) {
+      setSlotLive(i, false);
+    }
+  }
+
+  void printSubtree(int i_top) {
+    traversePreorder(i_top, [&](int i, int indent) {
+      for (int j=0; j < indent; ++j) {
+        if (j == indent - 1) { printf("└──"); }
+        else                 { printf("   "); }
+      }
+
+      Node &n = nodes[i];
+
+      printf("☐  index: %d  ", i);
+      printf("children: ");
+      for (int c = n.first_child; c != -1; c = nodes[c].next_sibling) {
+        printf("%d ", c);
+      }
+      printf(" parent: ");
+      if (n.parent == -1) { printf("[none]"); }
+      else                { printf("%d", n.parent); }
+      printf("\n");
+    });
+  }
+
+  // Traversal
+  // -----------------------------
+  // visit(i, depth) is called for each node in the subtree at i. Pre- and
+  // post-order walks follow the child, sibling and parent links, so need no
+  // stack. A visitor may free the node it is passed, but must not otherwise
+  // restructure the subtree being walked.
+
+  std::vector<int> walk_queue;
+
+  template <class Visitor>
+  void traversePreorder(int i_start, Visitor visit) {
+    int i = i_start;
+    int depth = 0;
+
+    while (true) {
+      visit(i, depth);
+
+      if (nodes[i].first_child != -1) {
+        i = nodes[i].first_child;
+        ++depth;
+        continue;
+      }
+
+      // Climb to the nearest node with a next sibling
+      while (i != i_start && nodes[i].next_sibling == -1) {
+        i = nodes[i].parent;
+        --depth;
+      }
+      if (i == i_start) {
+        return;
+      }
+      i = nodes[i].next_sibling;
+    }
+  }
+
+  template <class Visitor>
+  void traversePostorder(int i_start, Visitor visit) {
+    int i = i_start;
+    int depth = 0;
+
+    while (nodes[i].first_child != -1) {
+      i = nodes[i].first_child;
+      ++depth;
+    }
+
+    while (true) {
+      int next   = nodes[i].next_sibling;
+      int parent = nodes[i].parent;
+      bool done  = (i == i_start);
+
+      visit(i, depth);
+      if (done) {
+        return;
+      }
+
+      if (next != -1) {
+        i = next;
+        while (nodes[i].first_child != -1) {
+          i = nodes[i].first_child;
+          ++depth;
+        }
+      }
+      else {
+        i = parent;
+        --depth;
+      }
+    }
+  }
+
+  template <class Visitor>
+  void traverseLevelorder(int i_start, Visitor visit) {
+    // Queue entries are (index, depth) pairs. The queue's storage is kept
+    // between walks; nested walks swap it out and use their own.
+    std::vector<int> queue;
+    queue.swap(walk_queue);
+    queue.push_back(i_start);
+    queue.push_back(0);
+
+    for (size_t head = 0; head < queue.size(); head += 2) {
+      int i     = queue[head];
+      int depth = queue[head + 1];
+      visit(i, depth);
+
+      for (int c = nodes[i].first_child; c != -1; c = nodes[c].next_sibling) {
+        queue.push_back(c);
+        queue.push_back(depth + 1);
+      }
+    }
+
+    queue.clear();
+    walk_queue.swap(queue);
+  }
+
+public:
+
+  // Binary snapshots
+  // -----------------------------
+  // A compact alternative to the Diatom format - see GenericTree_Binary.h. The
+  // format is shared with GenericTree_Nodeless.
+  // readBinary() returns false if the snapshot is truncated or malformed, leaving
+  // the tree unchanged.
+
+  bool writeBinary(FILE *f) {
+    return GenericTree_Binary::writeStructure(
+      f, 0, int(nodes.size()), root, free_list,
+      [&](int i) { return slotIsLive(i); },
+      [&](int i) { return nodes[i].parent; },
+      [&](int i, std::vector<int32_t> &out) {
+        for (int c = nodes[i].first_child; c != -1; c = nodes[c].next_sibling) {
+          out.push_back(c);
+        }
+      }
+    );
+  }
+
+  bool readBinary(FILE *f) {
+    GenericTree_BinaryStructure s;
+    if (!GenericTree_Binary::readStructure(f, s)) {
+      return false;
+    }
+
+    reset();
+
+    int n = s.header.n_nodes;
+    Node empty = { -1, -1, -1, -1 };
+    nodes.assign(n, empty);
+    for (int i=0; i < n; ++i) {
+      for (int k = s.childrenBegin(i); k < s.childrenEnd(i); ++k) {
+        appendChild(i, s.children[k]);
+      }
+    }
+    for (int i=0; i < n; ++i) {
+      nodes[i].parent = s.parent[i];
+    }
+    free_list.assign(s.free_list.begin(), s.free_list.end());
+
+    rebuildLiveSlots();
+    root = s.header.root;
+    return true;
+  }
+
+  bool writeBinary(const char *path) {
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+      return false;
+    }
+    bool ok = writeBinary(f);
+    return fclose(f) == 0 && ok;
+  }
+
+  bool readBinary(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+      return false;
+    }
+    bool ok = readBinary(f);
+    fclose(f);
+    return ok;
+  }
+
+#ifdef _GT_ENABLE_SERIALIZATION
+
+public:
+
+  // Serialization
+  // -----------------------------
+  // Uses the same format as GenericTree_Nodeless, so files can be loaded by either.
+  // Free slots are not written.
+
+  Diatom toDiatom() {
+    Diatom d;
+
+    // Tree
+    {
+      d["tree"] = Diatom();
+
+      for (int i=0; i < nodes.size(); ++i) {
+        if (!slotIsLive(i)) {
+          continue;
+        }
+
+        Node &n = nodes[i];
+        Diatom &d_node = d["tree"][srlz_index(i)] = Diatom();
+
+        d_node["i"] = (double) i;
+        d_node["i__parent"] = (double) n.parent;
+        d_node["i__children"] = Diatom();
+        int j = 0;
+        for (int c = n.first_child; c != -1; c = nodes[c].next_sibling) {
+          d_node["i__children"][srlz_index(j++)] = (double) c;
+        }
+      }
+    }
+
+    // Free list
+    {
+      d["free_list"] = Diatom();
+      for (int i=0; i < free_list.size(); ++i) {
+        d["free_list"][srlz_index(i)] = (double) free_list[i];
+      }
+    }
+
+    return d;
+  }
+
+  void fromDiatom(Diatom &d) {
+    _assert(d.is_table());
+    _assert(d["tree"].is_table());
+    _assert(d["free_list"].is_table());
+
+    reset();
+
+    // Free list
+    std::vector<bool> is_free;
+    d["free_list"].each([&](std::string &key, Diatom &f) {
+      _assert(f.is_number());
+      int i = (int) f.number_value;
+      free_list.push_back(i);
+
+      if (is_free.size() <= i) {
+        is_free.resize(i + 1, false);
+      }
+      is_free[i] = true;
+      ensureSlot(i);
+    });
+
+    // Tree
+    // - records for free slots, which files written by GenericTree_Nodeless may
+    //   contain, are skipped
+    d["tree"].each([&](std::string &key, Diatom &item) {
+      _assert(item["i"].is_number());
+      _assert(item["i__parent"].is_number());
+      _assert(item["i__children"].is_table());
+
+      int i = (int) item["i"].number_value;
+      if (i < is_free.size() && is_free[i]) {
+        return;
+      }
+      ensureSlot(i);
+
+      nodes[i].parent = (int) item["i__parent"].number_value;
+
+      item["i__children"].each([&](std::string &ch_key, Diatom &c) {
+        _assert(c.is_number());
+        int ch = (int) c.number_value;
+        ensureSlot(ch);
+        appendChild(i, ch);
+      });
+    });
+
+    rebuildLiveSlots();
+    root = findTopNode();
+  }
+
+private:
+  void ensureSlot(int i) {
+    if (nodes.size() <= i) {
+      Node empty = { -1, -1, -1, -1 };
+      nodes.resize(i + 1, empty);
+    }
+  }
+
+  static std::string srlz_index(int i) {
+    return std::string("n") + std::to_string(i);
+  }
+
+#endif
+
+};
+
+
+#endif  // ifndef __GenericTree_Linked_h
@@ -12,12 +12,55 @@
 
 #include <vector>
 #include <cstdio>
+#include <cstdint>
+#include <algorithm>
+
+#include "GenericTree_Binary.h"
+#include "GenericTree_AncestorIndex.h"
 
 // Optionally enable serialization
 #ifdef _GT_ENABLE_SERIALIZATION
   #include "Diatom/Diatom.h"
+  #include "GenericTree_DiatomStream.h"
+#endif
+
+// Optionally enable parallel walks
+#ifdef _GT_ENABLE_PARALLEL
+  #include "GenericTree_Parallel.h"
+#endif
+
+// Optionally allocate node and child list storage from an arena
+#ifdef _GT_ENABLE_ARENA
+  #include "GenericTree_Arena.h"
+#endif
+
+// Optionally define _GT_ENABLE_HANDLES for generational handles, which detect
+// an index whose node has since been removed, in O(1) (see Handle)
+
+// Optionally count work done on hot paths, returned by stats()
+#ifdef _GT_ENABLE_STATS
+  #include "GenericTree_Stats.h"
+  #define _GT_STAT(x) x
+#else
+  #define _GT_STAT(x)
+#endif
+
+// Optionally record changes in a journal, for incremental saves
+#ifdef _GT_ENABLE_JOURNAL
+  #include "GenericTree_Journal.h"
+  #define _GT_JOURNAL(x) if (journal) { journal->x; }
+#else
+  #define _GT_JOURNAL(x)
 #endif
 
+// Optionally define _GT_ENABLE_SUBTREE_INFO to store each node's subtree
+// size and depth, for O(1) subtreeSize() and depth()
+
+// Optionally define _GT_UNORDERED_CHILDREN to keep each node's position in
+// its parent's child list, so that removing a child takes O(1), by moving the
+// parent's last child into its place. Children are then not kept in insertion
+// order. (GenericTree_Linked removes children in O(1) and keeps their order.)
+
 // Optionally disable asserts
 #ifdef _GT_DISABLE_SAFETY_CHECKS
   #define _assert(x)
@@ -29,28 +72,187 @@
 
 class GenericTree_Nodeless {
 public:
+#ifdef _GT_ENABLE_ARENA
+  typedef std::vector<int, GenericTree_ArenaAllocator<int>> ChildList;
+#else
+  typedef std::vector<int> ChildList;
+#endif
+
   struct Node {
     int parent;
-    std::vector<int> children;
+    ChildList children;
+#ifdef _GT_ENABLE_SUBTREE_INFO
+    int subtree_size;      // Nodes in the subtree at this node, itself included
+    int depth;             // 0 at the top of the tree, or of a detached subtree
+#endif
+#ifdef _GT_UNORDERED_CHILDREN
+    int index_in_parent;   // Position in the parent's child list
+#endif
+  };
+
+#ifdef _GT_ENABLE_ARENA
+  typedef std::vector<Node, GenericTree_ArenaAllocator<Node>> NodeList;
+#else
+  typedef std::vector<Node> NodeList;
+#endif
+
+  struct ChildSpan {
+    // A view of a node's child indices, valid until that node's children are
+    // next modified. Converts to std::vector<int> for callers that want a copy.
+    const int *first;
+    const int *last;
+
+    const int* begin() const { return first; }
+    const int* end()   const { return last; }
+    int  size()  const { return int(last - first); }
+    bool empty() const { return first == last; }
+    int  operator[](int k) const { return first[k]; }
+
+    operator std::vector<int>() const { return std::vector<int>(first, last); }
   };
 
   void reset() {
+#ifdef _GT_ENABLE_HANDLES
+    retireAllSlots();
+#endif
+#ifdef _GT_ENABLE_ARENA
+    // Release the storage, rather than clear(), so none is left in the arena
+    NodeList(GenericTree_ArenaAllocator<Node>(arena)).swap(nodes);
+#else
     nodes.clear();
+#endif
     free_list.clear();
+    live_slots.clear();
+    root = -1;
+    ancestor_index_stale = true;
+
+    batching = false;
+    batch_parents.clear();
+    batch_freed.clear();
   }
 
-  int addNode(int parent) {
-    Node node = { parent };
+  void reserve(size_t n) {
+    nodes.reserve(n);
+    live_slots.reserve((n + 63) >> 6);
+  }
+
+#ifdef _GT_ENABLE_STATS
+  // Stats
+  // -----------------------------
+  // Counts of work done on hot paths since construction or the last
+  // resetStats() - see GenericTree_Stats.h. reset() doesn't clear them.
+
+  const GenericTree_Stats& stats() {
+    noteFreeListLength();
+    return stat_counts;
+  }
+
+  void resetStats() {
+    stat_counts = GenericTree_Stats();
+  }
+#endif
+
+#ifdef _GT_ENABLE_ARENA
+  // Arena allocation
+  // -----------------------------
+  // With _GT_ENABLE_ARENA defined, the nodes vector and the child lists are
+  // allocated from the arena set here (or from the heap if none is set), so
+  // that building a tree doesn't allocate per node. See GenericTree_Arena.h.
+  //  - setArena() resets the tree
+  //  - reset the tree before resetting its arena, as the arena's memory is
+  //    then reused
+
+  void setArena(GenericTree_Arena *_arena) {
+    arena = _arena;
+    reset();
+  }
+#endif
+
+  // Bulk construction
+  // -----------------------------
+  // Build the tree from an array of n parent indices, where parent[i] is the
+  // index of node i's parent, or -1 for the root. Node i gets index i, and
+  // children are ordered by index.
+  //  - builds all child lists in two linear passes (count, then fill)
+  //  - fails, leaving the tree empty, unless there is exactly one root and every
+  //    node is reachable from it
+
+  bool buildFromParentArray(const int *parent, size_t n) {
+    reset();
+    if (n == 0) {
+      return true;
+    }
+
+    // Pass 1: validate parents & count children
+    std::vector<int> n_children(n, 0);
+    int i_top = -1;
+
+    for (int i=0; i < int(n); ++i) {
+      int p = parent[i];
+      if (p == -1) {
+        if (i_top != -1) {
+          return false;    // More than one root
+        }
+        i_top = i;
+      }
+      else if (p < 0 || p >= int(n) || p == i) {
+        return false;
+      }
+      else {
+        ++n_children[p];
+      }
+    }
+    if (i_top == -1) {
+      return false;
+    }
+
+    // Pass 2: fill
+    nodes.resize(n, blankNode());
+    for (int i=0; i < int(n); ++i) {
+      nodes[i].parent = parent[i];
+      nodes[i].children.reserve(n_children[i]);
+    }
+    for (int i=0; i < int(n); ++i) {
+      if (parent[i] != -1) {
+        nodes[parent[i]].children.push_back(i);
+      }
+    }
+
+    rebuildLiveSlots();
+    indexAllChildPositions();
+    rebuildSubtreeInfo();
+    root = i_top;
+
+    // Every node must be reachable from the root, otherwise the parent array
+    // contains a cycle
+    int n_reached = 0;
+    traversePreorder(i_top, [&](int i, int depth) { ++n_reached; });
+    if (n_reached != int(n)) {
+      reset();
+      return false;
+    }
 
-    bool was_empty = isEmpty();
+    return true;
+  }
+
+  static GenericTree_Nodeless fromParentArray(const int *parent, size_t n) {
+    GenericTree_Nodeless t;
+    bool ok = t.buildFromParentArray(parent, n);
+    _assert(ok);
+    return t;
+  }
+
+  int addNode(int parent) {
+    Node node = blankNode(parent);
 
     // Return an index for the caller to use to add the node to the externally-managed vector.
     int i = -1;
-    int i__prev_top = was_empty ? -1 : indexOfTopNode();
+    int i__prev_top = root;
 
     if (free_list.size() > 0) {
       i = free_list.back();
       free_list.pop_back();
+      _GT_STAT(++stat_counts.free_list_reuses);
 
       nodes[i] = node;
     }
@@ -58,17 +260,24 @@ public:
       i = (int) nodes.size();
       nodes.push_back(node);
     }
+    setSlotLive(i, true);
+    subtreeInfo_Add(i, parent, i__prev_top);
+    ancestor_index_stale = true;
+    _GT_JOURNAL(add(i, parent));
 
     // Add node to parent's children array
     if (parent != -1) {
-      nodes[parent].children.push_back(i);
+      appendChild(parent, i);
     }
 
     // Or if the node is being inserted at the top, deal with current
     // top node (if present)
-    if (parent == -1 && !was_empty) {
-      nodes[i].children.push_back(i__prev_top);
-      nodes[i__prev_top].parent = i;
+    if (parent == -1) {
+      if (i__prev_top != -1) {
+        appendChild(i, i__prev_top);
+        nodes[i__prev_top].parent = i;
+      }
+      root = i;
     }
 
     return i;
@@ -89,13 +298,24 @@ public:
   }
 
   void removeNode(int i, bool recursively_remove_children) {
-    _assert(i > 0 && i < nodes.size());
+    _assert(i >= 0 && i < nodes.size());
+
+    subtreeInfo_Detach(i);
+    if (!recursively_remove_children) {
+      subtreeInfo_Orphan(i);
+    }
 
     Node &node = nodes[i];
-    free_list.push_back(i);
+    freeSlot(i);
+    ancestor_index_stale = true;
+    _GT_JOURNAL(remove(i, recursively_remove_children));
 
     if (node.parent != -1) {
-      unmakeChild(node.parent, i);
+      if (batching) batch_parents.push_back(node.parent);
+      else          unmakeChild(node.parent, i);
+    }
+    if (i == root) {
+      root = -1;
     }
 
     if (recursively_remove_children) {
@@ -103,6 +323,79 @@ public:
     }
   }
 
+  bool moveSubtree(int i, int new_parent, int position = -1) {
+    // Make i the child of new_parent at position (after i is removed from its
+    // old parent), or its last child if -1, taking its subtree with it. Only
+    // the two child lists change, so the cost doesn't depend on the size of the
+    // subtree. Fails if new_parent is in i's subtree, or if i is the top node,
+    // as then new_parent could only be in an orphaned subtree.
+    _assert(nodeIsPresent(i) && nodeIsPresent(new_parent));
+    _assert(position == -1 || !batching);
+
+    if (i == root || subtreeContains(i, new_parent)) {
+      return false;
+    }
+
+    subtreeInfo_Detach(i);
+
+    int old_parent = nodes[i].parent;
+    if (old_parent != -1) {
+      if (batching) batch_parents.push_back(old_parent);
+      else          unmakeChild(old_parent, i);
+    }
+
+    insertChild(new_parent, i, position);
+    nodes[i].parent = new_parent;
+    subtreeInfo_Attach(i);
+    ancestor_index_stale = true;
+    _GT_JOURNAL(move(i, new_parent, position));
+    return true;
+  }
+
+  // Batches
+  // -----------------------------
+  // Between beginBatch() and commit(), removeNode() and moveSubtree() leave
+  // the node in its old parent's child list, only noting the parent as
+  // affected. commit() then filters each affected parent's list in a single
+  // pass, so removing or moving many children of a wide parent is linear
+  // rather than quadratic. Slots freed during a batch are only reused after
+  // commit(), and moves during a batch can only append (position -1).
+  //
+  // Until commit(), child lists may still contain nodes removed or moved away
+  // during the batch, so walks and child queries should wait for commit().
+
+  void beginBatch() {
+    _assert(!batching);
+    batching = true;
+    _GT_JOURNAL(beginBatch());
+  }
+
+  void commit() {
+    _assert(batching);
+    _GT_JOURNAL(commit());
+    batching = false;
+
+    std::sort(batch_parents.begin(), batch_parents.end());
+    batch_parents.erase(std::unique(batch_parents.begin(), batch_parents.end()), batch_parents.end());
+
+    if (batch_mark.size() < nodes.size()) {
+      batch_mark.resize(nodes.size(), 0);
+    }
+    for (auto p : batch_parents) {
+      filterChildren(p);
+      indexChildPositions(p);
+    }
+    batch_parents.clear();
+
+    free_list.insert(free_list.end(), batch_freed.begin(), batch_freed.end());
+    batch_freed.clear();
+    _GT_STAT(noteFreeListLength());
+  }
+
+  bool isBatching() {
+    return batching;
+  }
+
   int indexForChild(int parent, int child_in_children_vec) {
     _assert(parent >= 0 && parent < nodes.size());
     _assert(child_in_children_vec >= 0);
@@ -117,7 +410,7 @@ public:
       printf("[Tree is empty]\n");
     }
     else {
-      recursivelyPrintNode(i_top);
+      printSubtree(i_top);
     }
 
     size_t n_fl = free_list.size();
@@ -133,40 +426,150 @@ public:
 
   template <class Functor>
   void walk(Functor f, int i = -2) {
+    if (i == -2) {
+      i = indexOfTopNode();
+    }
+
     if (i == -1) {
       return;
     }
 
+    traversePreorder(i, [&](int j, int depth) { f(j); });
+  }
+    // walk:           parents before children
+    // walk_postorder: children before parents
+    // walk_levelorder: breadth-first, level by level
+
+  template <class Functor>
+  void walk_postorder(Functor f, int i = -2) {
     if (i == -2) {
       i = indexOfTopNode();
     }
 
-    f(i);
-    for (auto &i : nodes[i].children) {
-      walk(f, i);
+    if (i == -1) {
+      return;
     }
+
+    traversePostorder(i, [&](int j, int depth) { f(j); });
   }
 
-  int indexOfTopNode() {
-    if (isEmpty()) {
-      return -1;
+  template <class Functor>
+  void walk_levelorder(Functor f, int i = -2) {
+    if (i == -2) {
+      i = indexOfTopNode();
+    }
+
+    if (i == -1) {
+      return;
     }
 
-    int i_top = 0;
-    while (indexIsInFreeList(i_top)) {
-      ++i_top;
+    traverseLevelorder(i, [&](int j, int depth) { f(j); });
+  }
+
+  // Reduction
+  // -----------------------------
+  // Fold the subtree at i bottom-up, writing a value for each of its nodes into
+  // out, which is indexed by node index and so must have an entry for each
+  // index in the subtree:
+  //    out[j] = combineFn(...combineFn(leafFn(j), out[c0])..., out[cn])
+  // for j's children c0...cn, in order. Nothing else is allocated.
+  //  - leafFn(j) -> Value
+  //  - combineFn(const Value &acc, const Value &child) -> Value
+
+  template <class Value, class LeafFn, class CombineFn>
+  void reduce(Value *out, LeafFn leafFn, CombineFn combineFn, int i = -2) {
+    if (i == -2) {
+      i = indexOfTopNode();
+    }
+
+    if (i == -1) {
+      return;
     }
-    while (nodes[i_top].parent != -1) {
-      i_top = nodes[i_top].parent;
+
+    traversePostorder(i, [&](int j, int depth) { reduceNode(out, leafFn, combineFn, j); });
+  }
+
+#ifdef _GT_ENABLE_PARALLEL
+  template <class Value, class LeafFn, class CombineFn>
+  void parallel_reduce(Value *out, LeafFn leafFn, CombineFn combineFn, int grain = 1024, int i = -2) {
+    // As reduce, evaluating separate subtrees concurrently (see
+    // GenericTree_Parallel.h). leafFn and combineFn must be safe to call
+    // from several threads at once.
+    if (i == -2) {
+      i = indexOfTopNode();
     }
 
-    return i_top;
+    if (i == -1) {
+      return;
+    }
+
+    GenericTree_ParallelReduce::run(i, grain, parallel_threads.get(), reduce_scratch,
+      [this](int j) -> const ChildList& { return nodes[j].children; },
+      [&](int j) { reduceNode(out, leafFn, combineFn, j); });
+  }
+
+  // Parallel walks
+  // -----------------------------
+  // Walk parents before children, visiting separate subtrees concurrently on a
+  // work-stealing pool (see GenericTree_Parallel.h). f is called from several
+  // threads at once, so must be safe to call concurrently for different nodes.
+  //  - grain: the number of nodes a thread visits before offering the rest of
+  //    its work to other threads. Smaller values balance better, larger ones
+  //    have less overhead.
+  //  - the tree must not be modified during the walk
+
+  template <class Functor>
+  void parallel_walk(Functor f, int grain = 1024, int i = -2) {
+    if (i == -2) {
+      i = indexOfTopNode();
+    }
+
+    if (i == -1) {
+      return;
+    }
+
+    GenericTree_ParallelWalk<char>::run(i, 0, grain, parallel_threads.get(),
+      [this](int j) -> const ChildList& { return nodes[j].children; },
+      [&f](int j, int depth, char) -> char { f(j); return 0; });
+  }
+
+  template <class Functor, class Return>
+  void parallel_walk_and_pass(Functor f, const Return &r_parent, int grain = 1024, int i = -2) {
+    // The value returned by f(i, r_parent) is passed to each of i's children
+    if (i == -2) {
+      i = indexOfTopNode();
+    }
+
+    if (i == -1) {
+      return;
+    }
+
+    GenericTree_ParallelWalk<Return>::run(i, r_parent, grain, parallel_threads.get(),
+      [this](int j) -> const ChildList& { return nodes[j].children; },
+      [&f](int j, int depth, const Return &r) -> Return { return f(j, r); });
+  }
+
+  void setParallelThreads(int n) {
+    // The number of threads used by parallel walks; 0 for one per hardware thread.
+    // The threads are started by the next parallel walk, and kept for later ones.
+    parallel_threads.setThreadCount(n);
+  }
+#endif
+
+  int indexOfTopNode() {
+    return root;
   }
 
   int nChildren(int i) {
     return (int) nodes[i].children.size();
   }
 
+  ChildSpan children(int i) {
+    _assert(i >= 0 && i < nodes.size());
+    const ChildList &ch = nodes[i].children;
+    return { ch.data(), ch.data() + ch.size() };
+  }
+
   int parentIndex(int i) {
     return nodes[i].parent;
   }
@@ -175,157 +578,1159 @@ public:
     return nodes.size() == free_list.size();
   }
 
-protected:
-  std::vector<Node> nodes;
-  std::vector<int> free_list;
+#ifdef _GT_ENABLE_SUBTREE_INFO
+  // Subtree sizes & depths
+  // -----------------------------
+  // Kept up to date as the tree changes, so both are read in O(1):
+  //  - adding or removing a node updates its ancestors' sizes, in O(depth)
+  //  - adding a node at the top, or removing one non-recursively, also updates
+  //    depths, in O(size) of the subtrees affected
+  //  - the children of a node removed non-recursively become the tops of
+  //    detached subtrees, at depth 0, and are counted in no ancestor's size
+
+  int subtreeSize(int i) {
+    // Including i itself
+    _assert(i >= 0 && i < nodes.size() && slotIsLive(i));
+    return nodes[i].subtree_size;
+  }
 
-  void removeChildren(int i) {
-    _assert(i < nodes.size());
+  int depth(int i) {
+    _assert(i >= 0 && i < nodes.size() && slotIsLive(i));
+    return nodes[i].depth;
+  }
+#endif
 
-    for (auto &i : nodes[i].children) {
-      removeChildren(i);
-      free_list.push_back(i);
-    }
+  // Ancestor index
+  // -----------------------------
+  // Numbers the nodes of the tree in pre-order (see GenericTree_AncestorIndex.h),
+  // so that these are O(1) rather than climbs or walks. The index is built by
+  // buildAncestorIndex(), or by the first query after the tree has changed:
+  // call it first when querying from several threads. Nodes of orphaned
+  // subtrees are not indexed, and are no node's ancestor.
+
+  void buildAncestorIndex() {
+    _assert(!batching);
+    ancestor_index.build(int(nodes.size()), root, [&](int i) -> const ChildList& {
+      return nodes[i].children;
+    });
+    ancestor_index_stale = false;
   }
 
-  bool nodeIsPresent(int i) {
-    return i != -1 && !indexIsInFreeList(i);
+  bool isAncestor(int a, int b) {
+    // Whether a is b, or one of b's ancestors
+    return ancestorIndex().isAncestor(a, b);
   }
 
-  bool indexIsInFreeList(int i) {
-    for (const auto &f : free_list) {
-      if (i == f) {
-        return true;
-      }
-    }
-    return false;
+  int lowestCommonAncestor(int a, int b) {
+    // -1 unless both are in the tree
+    return ancestorIndex().lowestCommonAncestor(a, b);
   }
 
-  void unmakeChild(int parent, int child_to_remove) {
-    _assert(parent > 0 && parent < nodes.size());
-    _assert(child_to_remove > 0 && child_to_remove < nodes.size());
+  ChildSpan subtreeNodes(int i) {
+    // The nodes of the subtree at i, i first, in pre-order. Valid until the
+    // tree next changes.
+    auto r = ancestorIndex().subtree(i);
+    return { r.first, r.second };
+  }
 
-    auto &children = nodes[parent].children;
+  // Compaction
+  // -----------------------------
+  // compact() removes free slots and renumbers the live nodes in pre-order, so
+  // that walks sweep the nodes vector sequentially. Subtrees orphaned by
+  // non-recursive removal are kept, numbered after the main tree.
+  //
+  // Returns a table mapping each old index to its new one (or -1 for a slot that
+  // was free). Use applyRemap() to permute an externally-managed vector
+  // (such as the one used with addNodeAndInsert) to match.
+
+  std::vector<int> compact() {
+    _assert(!batching);
+
+    std::vector<int> order;
+    collectLiveNodes(order);
+    _GT_JOURNAL(compact());
+    return relayout(order);
+  }
 
-    std::vector<int>::iterator it;
-    for (it = children.begin(); it != children.end(); ++it) {
-      if (*it == child_to_remove) {
-        break;
+  template<class T>
+  static void applyRemap(const std::vector<int> &remap, std::vector<T> &ext_nodes) {
+    _assert(ext_nodes.size() >= remap.size());
+
+    std::vector<int> old_index;
+    for (int i=0, n = int(remap.size()); i < n; ++i) {
+      if (remap[i] != -1) {
+        if (old_index.size() <= remap[i]) {
+          old_index.resize(remap[i] + 1, -1);
+        }
+        old_index[remap[i]] = i;
       }
     }
 
-    if (it != children.end()) {
-      children.erase(it);
+    std::vector<T> relaid;
+    relaid.reserve(old_index.size());
+    for (auto i : old_index) {
+      relaid.push_back(std::move(ext_nodes[i]));
     }
+    ext_nodes.swap(relaid);
   }
 
-  int indentCount = 0;
-  void recursivelyPrintNode(int i) {
-    for (int i=0; i < indentCount; ++i) {
-      if (i == indentCount - 1) { printf("└──"); }
-      else                      { printf("   "); }
-    }
+#ifdef _GT_ENABLE_HANDLES
+  // Handles
+  // -----------------------------
+  // A node's index, with the generation of its slot when the handle was made.
+  // A slot's generation is incremented whenever its node is removed, so a
+  // handle kept across changes to the tree can be checked in O(1), and is never
+  // mistaken for a later node reusing the slot. compact() and reset()
+  // invalidate all handles.
+
+  struct Handle {
+    int      index;
+    uint32_t generation;
+  };
 
-    Node &n = nodes[i];
+  Handle handle(int i) {
+    _assert(i >= 0 && i < nodes.size() && slotIsLive(i));
+    return { i, slotGeneration(i) };
+  }
 
-    printf("☐  index: %d  ", i);
-    printf("children: ");
-    for (auto &i : n.children) {
-      printf("%d ", i);
-    }
-    printf(" parent: ");
-    if (n.parent == -1) { printf("[none]"); }
-    else                { printf("%d", n.parent); }
-    printf("\n");
+  bool isValid(Handle h) {
+    return slotIsLive(h.index) && slotGeneration(h.index) == h.generation;
+  }
 
-    indentCount += 1;
-    for (auto &i : nodes[i].children) {
-      recursivelyPrintNode(i);
-    }
-    indentCount -= 1;
+  int indexForHandle(Handle h) {
+    // The handle's node index, or -1 if the handle is no longer valid
+    return isValid(h) ? h.index : -1;
   }
+#endif
 
-#ifdef _GT_ENABLE_SERIALIZATION
+protected:
+  NodeList nodes;
+  std::vector<int> free_list;
+  int root = -1;
 
-public:
+  GenericTree_AncestorIndex ancestor_index;
+  bool ancestor_index_stale = true;
 
-  // Serialization
-  // -----------------------------
-  // Assuming the tree owner has a vector of pointers to the nodes in the tree,
-  // we can serialize the tree by writing out all the relevant indices.
+  GenericTree_AncestorIndex& ancestorIndex() {
+    if (ancestor_index_stale) {
+      buildAncestorIndex();
+    }
+    return ancestor_index;
+  }
 
-  Diatom toDiatom() {
-    Diatom d;
+#ifdef _GT_ENABLE_ARENA
+  GenericTree_Arena *arena = NULL;
+#endif
 
-    // Tree
-    {
-      d["tree"] = Diatom();
+#ifdef _GT_ENABLE_JOURNAL
+  GenericTree_Journal *journal = NULL;
 
-      for (int i=0; i < nodes.size(); ++i) {
-        Node &n = nodes[i];
-        Diatom &d_node = d["tree"][srlz_index(i)] = Diatom();
+  bool replayRecord(const GenericTree_JournalRecord &r) {
+    // Apply r, if it is valid for the tree as it is
+    auto live = [&](int i) { return i >= 0 && i < int(nodes.size()) && slotIsLive(i); };
 
-        d_node["i"] = (double) i;
-        d_node["i__parent"] = (double) n.parent;
-        d_node["i__children"] = Diatom();
-        for (int j=0; j < n.children.size(); ++j) {
-          d_node["i__children"][srlz_index(j)] = (double) n.children[j];
-        }
-      }
+    switch (r.op) {
+      case GenericTree_Journal::Add:
+        return (r.a == -1 || live(r.a)) && addNode(r.a) == r.i;
+      case GenericTree_Journal::Remove:
+        if (!live(r.i)) return false;
+        removeNode(r.i, r.a != 0);
+        return true;
+      case GenericTree_Journal::Move:
+        return live(r.i) && live(r.a) && r.b >= -1 && (r.b == -1 || !batching) &&
+               moveSubtree(r.i, r.a, r.b);
+      case GenericTree_Journal::BeginBatch:
+        if (batching) return false;
+        beginBatch();
+        return true;
+      case GenericTree_Journal::Commit:
+        if (!batching) return false;
+        commit();
+        return true;
+      case GenericTree_Journal::Compact:
+        if (batching) return false;
+        compact();
+        return true;
     }
+    return false;
+  }
+#endif
 
-    // Free list
-    {
-      d["free_list"] = Diatom();
-      for (int i=0; i < free_list.size(); ++i) {
-        d["free_list"][srlz_index(i)] = (double) i;
-      }
+#ifdef _GT_ENABLE_STATS
+  GenericTree_Stats stat_counts;
+
+  void noteFreeListLength() {
+    if (free_list.size() > stat_counts.peak_free_list) {
+      stat_counts.peak_free_list = free_list.size();
     }
+  }
+#endif
 
-    return d;
+  Node blankNode(int parent = -1) {
+    Node node = { parent };
+#ifdef _GT_ENABLE_ARENA
+    node.children = ChildList(GenericTree_ArenaAllocator<int>(arena));
+#endif
+    return node;
   }
 
-  void fromDiatom(Diatom &d) {
-    _assert(d.is_table());
-    _assert(d["tree"].is_table());
-    _assert(d["free_list"].is_table());
+#ifdef _GT_ENABLE_PARALLEL
+  GenericTree_ThreadPoolHandle parallel_threads;
+  GenericTree_ParallelReduce::Scratch reduce_scratch;
+#endif
 
-    reset();
+  int findTopNode() {
+    // Find the top node by climbing from the first live slot
+    if (isEmpty()) {
+      return -1;
+    }
 
-    // Tree
-    d["tree"].each([&](std::string &key, Diatom &item) {
-      _assert(item["i"].is_number());
-      _assert(item["i__parent"].is_number());
-      _assert(item["i__children"].is_table());
+    // Only parents which list their child are followed: an orphan's stale
+    // parent may since have been reused below it
+    int i_top = firstLiveSlot();
+    for (int p; (p = nodes[i_top].parent) != -1 && slotIsLive(p) && nodeListsChild(p, i_top); ) {
+      _GT_STAT(++stat_counts.top_climbs);
+      i_top = p;
+    }
 
-      int i = (int) item["i"].number_value;
-      int parent = (int) item["i__parent"].number_value;
+    return i_top;
+  }
 
-      Node n = { parent };
+  void collectLiveNodes(std::vector<int> &order) {
+    // Live node indices in pre-order: the tree from the root, then any orphaned
+    // subtrees, each from its topmost live ancestor
+    std::vector<bool> seen(nodes.size(), false);
+    order.reserve(nodes.size() - free_list.size());
 
-      item["i__children"].each([&](std::string &ch_key, Diatom &c) {
-        _assert(c.is_number());
-        n.children.push_back((int) c.number_value);
+    auto collect = [&](int i_top) {
+      traversePreorder(i_top, [&](int i, int depth) {
+        seen[i] = true;
+        order.push_back(i);
       });
+    };
 
-      if (nodes.size() <= i) {
-        nodes.resize(i + 1);
+    if (root != -1) {
+      collect(root);
+    }
+    for (int i=0, n = int(nodes.size()); i < n; ++i) {
+      if (!slotIsLive(i) || seen[i]) {
+        continue;
+      }
+
+      int i_top = i;
+      while (true) {
+        int p = nodes[i_top].parent;
+        if (p == -1 || !slotIsLive(p) || seen[p] || !nodeListsChild(p, i_top)) {
+          break;
+        }
+        i_top = p;
+      }
+      collect(i_top);
+    }
+  }
+
+  std::vector<int> relayout(const std::vector<int> &order) {
+    // Rebuild the nodes vector with order[k] moved to index k. Every live node
+    // must appear in order exactly once. Parents are relinked from the child
+    // lists.
+    std::vector<int> remap(nodes.size(), -1);
+    for (int k=0, n = int(order.size()); k < n; ++k) {
+      remap[order[k]] = k;
+    }
+
+    NodeList relaid(order.size(), blankNode(), nodes.get_allocator());
+    for (int k=0, n = int(order.size()); k < n; ++k) {
+      Node &node = relaid[k];
+      node.children.swap(nodes[order[k]].children);
+      for (auto &c : node.children) {
+        c = remap[c];
+        relaid[c].parent = k;
+      }
+    }
+
+#ifdef _GT_ENABLE_HANDLES
+    retireAllSlots();
+#endif
+    nodes.swap(relaid);
+    free_list.clear();
+    rebuildLiveSlots();
+    indexAllChildPositions();
+    rebuildSubtreeInfo();
+    root = root == -1 ? -1 : remap[root];
+    ancestor_index_stale = true;
+
+    return remap;
+  }
+
+  bool nodeListsChild(int parent, int child) {
+    for (auto c : nodes[parent].children) {
+      if (c == child) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void removeChildren(int i) {
+    _assert(i < nodes.size());
+
+    if (batching) {
+      removeChildren_Batched(i);
+      return;
+    }
+
+    // Free descendants children-first
+    traversePostorder(i, [&](int j, int depth) {
+      if (j != i) {
+        freeSlot(j);
       }
-      nodes[i] = n;
     });
+  }
+
+  void appendChild(int parent, int child) {
+    _GT_STAT(stat_counts.child_reallocs += nodes[parent].children.size() == nodes[parent].children.capacity());
+    nodes[parent].children.push_back(child);
+#ifdef _GT_UNORDERED_CHILDREN
+    nodes[child].index_in_parent = int(nodes[parent].children.size()) - 1;
+#endif
+  }
+
+  void insertChild(int parent, int child, int position) {
+    // Insert child before the child at position, or append it if position is
+    // -1 or past the end
+    _assert(position >= -1);
+    auto &children = nodes[parent].children;
+    if (position == -1 || position >= int(children.size())) {
+      appendChild(parent, child);
+      return;
+    }
+
+    _GT_STAT(stat_counts.child_reallocs += children.size() == children.capacity());
+    children.insert(children.begin() + position, child);
+    indexChildPositions(parent);
+  }
+
+  void indexChildPositions(int parent) {
+#ifdef _GT_UNORDERED_CHILDREN
+    auto &children = nodes[parent].children;
+    for (int k=0, n = int(children.size()); k < n; ++k) {
+      nodes[children[k]].index_in_parent = k;
+    }
+#endif
+  }
+
+  void indexAllChildPositions() {
+#ifdef _GT_UNORDERED_CHILDREN
+    for (int i=0, n = int(nodes.size()); i < n; ++i) {
+      if (slotIsLive(i)) {
+        indexChildPositions(i);
+      }
+    }
+#endif
+  }
+
+  // Subtree info
+  // -----------------------------
+  // Called as nodes are added, removed, and moved, to maintain subtree sizes
+  // and depths. Empty unless _GT_ENABLE_SUBTREE_INFO is defined.
+
+  void subtreeInfo_Add(int i, int parent, int i__prev_top) {
+    // i is being added under parent, or at the top if parent is -1
+#ifdef _GT_ENABLE_SUBTREE_INFO
+    Node &node = nodes[i];
+    node.subtree_size = 1;
+    if (parent != -1) {
+      node.depth = nodes[parent].depth + 1;
+      addToAncestorSizes(parent, 1);
+    }
+    else {
+      node.depth = 0;
+      if (i__prev_top != -1) {
+        node.subtree_size += nodes[i__prev_top].subtree_size;
+        refreshDepths(i__prev_top, 1);
+      }
+    }
+#endif
+  }
+
+  void subtreeInfo_Detach(int i) {
+    // i's subtree is being removed from its parent
+#ifdef _GT_ENABLE_SUBTREE_INFO
+    if (nodes[i].depth > 0) {
+      addToAncestorSizes(nodes[i].parent, -nodes[i].subtree_size);
+    }
+#endif
+  }
+
+  void subtreeInfo_Attach(int i) {
+    // i's subtree has been made a child of its new parent. Depths within it only
+    // change if it moved to a different depth.
+#ifdef _GT_ENABLE_SUBTREE_INFO
+    int parent = nodes[i].parent;
+    int depth  = nodes[parent].depth + 1;
+    if (nodes[i].depth != depth) {
+      refreshDepths(i, depth);
+    }
+    addToAncestorSizes(parent, nodes[i].subtree_size);
+#endif
+  }
+
+  void subtreeInfo_Orphan(int i) {
+    // i is being removed, leaving its children as the tops of detached subtrees
+#ifdef _GT_ENABLE_SUBTREE_INFO
+    for (auto c : nodes[i].children) {
+      if (slotIsLive(c) && nodes[c].parent == i) {
+        refreshDepths(c, 0);
+      }
+    }
+#endif
+  }
+
+  void rebuildSubtreeInfo() {
+    // Recompute sizes and depths from the child lists. A live node is the top
+    // of a subtree if no live node lists it as a child.
+#ifdef _GT_ENABLE_SUBTREE_INFO
+    int n = int(nodes.size());
+    std::vector<char> attached(n, 0);
+    for (int i=0; i < n; ++i) {
+      if (slotIsLive(i)) {
+        for (auto c : nodes[i].children) {
+          if (nodes[c].parent == i) {
+            attached[c] = 1;
+          }
+        }
+      }
+    }
+
+    std::vector<int> order;
+    for (int i=0; i < n; ++i) {
+      if (slotIsLive(i) && !attached[i]) {
+        traversePreorder(i, [&](int j, int depth) {
+          nodes[j].subtree_size = 1;
+          nodes[j].depth = depth;
+          order.push_back(j);
+        });
+      }
+    }
+    for (int k = int(order.size()) - 1; k >= 0; --k) {
+      Node &node = nodes[order[k]];
+      if (node.depth > 0) {
+        nodes[node.parent].subtree_size += node.subtree_size;
+      }
+    }
+#endif
+  }
+
+#ifdef _GT_ENABLE_SUBTREE_INFO
+  void addToAncestorSizes(int i, int delta) {
+    // Add delta to the subtree sizes of i and each of its ancestors
+    while (true) {
+      nodes[i].subtree_size += delta;
+      if (nodes[i].depth == 0) {
+        break;
+      }
+      i = nodes[i].parent;
+    }
+  }
+
+  void refreshDepths(int i, int depth) {
+    // Set the depths in the subtree at i, with i at depth. Only descends into
+    // children still attached to their parent, since during a batch a child
+    // list can list nodes already moved away or removed.
+    std::vector<WalkFrame> stack;
+    stack.swap(walkStack());
+    stack.push_back({ i, depth, 0 });
+
+    while (!stack.empty()) {
+      WalkFrame fr = stack.back();
+      stack.pop_back();
+      nodes[fr.i].depth = fr.depth;
+
+      for (auto c : nodes[fr.i].children) {
+        if (slotIsLive(c) && nodes[c].parent == fr.i) {
+          stack.push_back({ c, fr.depth + 1, 0 });
+        }
+      }
+    }
+
+    walkStack().swap(stack);
+  }
+#endif
+
+  void freeSlot(int i) {
+    setSlotLive(i, false);
+#ifdef _GT_ENABLE_HANDLES
+    retireSlot(i);
+#endif
+    if (batching) batch_freed.push_back(i);
+    else          free_list.push_back(i);
+    _GT_STAT(noteFreeListLength());
+  }
+
+  bool subtreeContains(int i, int j) {
+    // Whether j is i or one of its descendants. Uses the ancestor index if it is
+    // up to date, otherwise climbs at most nodes.size() steps, as the parents of
+    // orphaned nodes may be stale.
+    if (!ancestor_index_stale && ancestor_index.contains(i) && ancestor_index.contains(j)) {
+      return ancestor_index.isAncestor(i, j);
+    }
+    for (int k=0, n = (int) nodes.size(); j != -1 && k <= n; j = nodes[j].parent, ++k) {
+      if (j == i) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Batch state
+  bool batching = false;
+  std::vector<int>  batch_parents;    // Parents whose child lists need filtering
+  std::vector<int>  batch_freed;      // Slots to add to the free list on commit
+  std::vector<char> batch_mark;
+
+  void removeChildren_Batched(int i) {
+    // As removeChildren, but only descending into children still attached to
+    // their parent, skipping those removed or moved away earlier in the batch
+    std::vector<WalkFrame> stack;
+    stack.swap(walkStack());
+    stack.push_back({ i, 0, 0 });
+
+    while (!stack.empty()) {
+      WalkFrame &fr = stack.back();
+      auto &children = nodes[fr.i].children;
+
+      if (fr.next_child < int(children.size())) {
+        int c = children[fr.next_child++];
+        if (slotIsLive(c) && nodes[c].parent == fr.i) {
+          stack.push_back({ c, fr.depth + 1, 0 });
+        }
+      }
+      else {
+        int j = fr.i;
+        stack.pop_back();
+        if (j != i) {
+          freeSlot(j);
+        }
+      }
+    }
+
+    walkStack().swap(stack);
+  }
+
+  void filterChildren(int p) {
+    // Keep the children still attached to p. A node moved more than once
+    // within the batch can be listed several times: keep the last, as that is
+    // where it was most recently added.
+    auto &children = nodes[p].children;
+    int n = int(children.size());
+    int w = n;
+
+    for (int k = n - 1; k >= 0; --k) {
+      int c = children[k];
+      if (slotIsLive(c) && nodes[c].parent == p && !batch_mark[c]) {
+        batch_mark[c] = 1;
+        children[--w] = c;
+      }
+    }
+    children.erase(children.begin(), children.begin() + w);
+
+    for (auto c : children) {
+      batch_mark[c] = 0;
+    }
+  }
+
+  bool nodeIsPresent(int i) {
+    return i != -1 && !indexIsInFreeList(i);
+  }
+
+  bool indexIsInFreeList(int i) {
+    return !slotIsLive(i);
+  }
+
+  void unmakeChild(int parent, int child_to_remove) {
+    _assert(parent >= 0 && parent < nodes.size());
+    _assert(child_to_remove >= 0 && child_to_remove < nodes.size());
+
+    auto &children = nodes[parent].children;
+
+#ifdef _GT_UNORDERED_CHILDREN
+    // Move the last child into the removed child's place. An orphan's stale
+    // parent may no longer list it.
+    int k = nodes[child_to_remove].index_in_parent;
+    if (k >= 0 && k < int(children.size()) && children[k] == child_to_remove) {
+      children[k] = children.back();
+      nodes[children[k]].index_in_parent = k;
+      children.pop_back();
+    }
+#else
+    ChildList::iterator it;
+    for (it = children.begin(); it != children.end(); ++it) {
+      if (*it == child_to_remove) {
+        break;
+      }
+    }
+    _GT_STAT(stat_counts.child_scan_steps += it - children.begin());
+
+    if (it != children.end()) {
+      children.erase(it);
+    }
+#endif
+  }
+
+  // Slot liveness
+  // -----------------------------
+  // One bit per slot in the nodes vector, set while the slot is in use, i.e.
+  // not in the free list. Lets membership checks run in O(1), and scans for
+  // live slots skip 64 dead slots at a time.
+
+  std::vector<uint64_t> live_slots;
+
+  void setSlotLive(int i, bool live) {
+    size_t w = size_t(i) >> 6;
+    if (w >= live_slots.size()) {
+      live_slots.resize(w + 1, 0);
+    }
+    uint64_t bit = uint64_t(1) << (i & 63);
+    if (live) { live_slots[w] |= bit;  }
+    else      { live_slots[w] &= ~bit; }
+  }
+
+  bool slotIsLive(int i) {
+    size_t w = size_t(i) >> 6;
+    return w < live_slots.size() && (live_slots[w] >> (i & 63)) & 1;
+  }
+
+  int firstLiveSlot() {
+    for (size_t w=0, n = live_slots.size(); w < n; ++w) {
+      _GT_STAT(++stat_counts.live_slot_scans);
+      uint64_t bits = live_slots[w];
+      if (bits) {
+        int b = 0;
+        while (!(bits & 1)) { bits >>= 1; ++b; }
+        return int(w << 6) + b;
+      }
+    }
+    return -1;
+  }
+
+  void rebuildLiveSlots() {
+    live_slots.assign((nodes.size() + 63) >> 6, 0);
+    for (int i=0, n = int(nodes.size()); i < n; ++i) {
+      setSlotLive(i, true);
+    }
+    for (auto i : free_list) {
+      setSlotLive(i, false);
+    }
+  }
+
+#ifdef _GT_ENABLE_HANDLES
+  // Slot generations
+  // -----------------------------
+  // Slots beyond the end of the vector are at generation 0
+
+  std::vector<uint32_t> generations;
+
+  uint32_t slotGeneration(int i) {
+    return size_t(i) < generations.size() ? generations[i] : 0;
+  }
+
+  void retireSlot(int i) {
+    if (size_t(i) >= generations.size()) {
+      generations.resize(i + 1, 0);
+    }
+    ++generations[i];
+  }
+
+  void retireAllSlots() {
+    // Move every slot past any generation handed out so far, for when nodes
+    // are renumbered or discarded wholesale
+    uint32_t g = 0;
+    for (auto x : generations) {
+      g = std::max(g, x);
+    }
+    generations.assign(std::max(generations.size(), nodes.size()), g + 1);
+  }
+#endif
+
+  void printSubtree(int i_top) {
+    traversePreorder(i_top, [&](int i, int indent) {
+      for (int j=0; j < indent; ++j) {
+        if (j == indent - 1) { printf("└──"); }
+        else                 { printf("   "); }
+      }
+
+      Node &n = nodes[i];
+
+      printf("☐  index: %d  ", i);
+      printf("children: ");
+      for (auto &c : n.children) {
+        printf("%d ", c);
+      }
+      printf(" parent: ");
+      if (n.parent == -1) { printf("[none]"); }
+      else                { printf("%d", n.parent); }
+      printf("\n");
+    });
+  }
+
+  template <class Value, class LeafFn, class CombineFn>
+  void reduceNode(Value *out, LeafFn &leafFn, CombineFn &combineFn, int j) {
+    // out[j] is written once, after all of j's children
+    Value v = leafFn(j);
+    for (auto c : nodes[j].children) {
+      v = combineFn(v, out[c]);
+    }
+    out[j] = v;
+  }
+
+  // Traversal
+  // -----------------------------
+  // Iterative traversal engines. These use an explicit stack rather than
+  // recursion, so arbitrarily deep trees can be walked without overflowing the
+  // thread stack. visit(i, depth) is called for each node in the subtree at i.
+  //
+  // The stack's storage is kept between walks, one per thread, so walks of a
+  // tree from several threads at once don't share it. A walk started from
+  // within a visitor swaps it out and uses its own, so nested walks are safe.
+
+  struct WalkFrame {
+    int i;
+    int depth;
+    int next_child;
+  };
+
+  static std::vector<WalkFrame>& walkStack() {
+    static thread_local std::vector<WalkFrame> stack;
+    return stack;
+  }
+
+  template <class Visitor>
+  void traversePreorder(int i_start, Visitor visit) {
+    std::vector<WalkFrame> stack;
+    stack.swap(walkStack());
+    stack.push_back({ i_start, 0, 0 });
+
+    while (!stack.empty()) {
+      WalkFrame fr = stack.back();
+      stack.pop_back();
+      visit(fr.i, fr.depth);
+
+      auto &children = nodes[fr.i].children;
+      for (int c = int(children.size()) - 1; c >= 0; --c) {
+        stack.push_back({ children[c], fr.depth + 1, 0 });
+      }
+    }
+
+    walkStack().swap(stack);
+  }
+
+  template <class Visitor>
+  void traversePostorder(int i_start, Visitor visit) {
+    std::vector<WalkFrame> stack;
+    stack.swap(walkStack());
+    stack.push_back({ i_start, 0, 0 });
+
+    while (!stack.empty()) {
+      WalkFrame &fr = stack.back();
+      auto &children = nodes[fr.i].children;
+
+      if (fr.next_child < int(children.size())) {
+        int c     = children[fr.next_child++];
+        int depth = fr.depth + 1;
+        stack.push_back({ c, depth, 0 });
+      }
+      else {
+        WalkFrame done = fr;
+        stack.pop_back();
+        visit(done.i, done.depth);
+      }
+    }
+
+    walkStack().swap(stack);
+  }
+
+  template <class Visitor>
+  void traverseLevelorder(int i_start, Visitor visit) {
+    std::vector<WalkFrame> queue;
+    queue.swap(walkStack());
+    queue.push_back({ i_start, 0, 0 });
+
+    for (size_t head = 0; head < queue.size(); ++head) {
+      WalkFrame fr = queue[head];
+      visit(fr.i, fr.depth);
+
+      for (auto c : nodes[fr.i].children) {
+        queue.push_back({ c, fr.depth + 1, 0 });
+      }
+    }
+
+    queue.clear();
+    walkStack().swap(queue);
+  }
+
+public:
+
+  // Binary snapshots
+  // -----------------------------
+  // A compact alternative to the Diatom format - see GenericTree_Binary.h.
+  // readBinary() returns false if the snapshot is truncated or malformed, leaving
+  // the tree unchanged.
+
+  bool writeBinary(FILE *f) {
+    return GenericTree_Binary::writeStructure(
+      f, 0, int(nodes.size()), root, free_list,
+      [&](int i) { return slotIsLive(i); },
+      [&](int i) { return nodes[i].parent; },
+      [&](int i, std::vector<int32_t> &out) {
+        out.insert(out.end(), nodes[i].children.begin(), nodes[i].children.end());
+      }
+    );
+  }
+
+  bool readBinary(FILE *f) {
+    GenericTree_BinaryStructure s;
+    if (!GenericTree_Binary::readStructure(f, s)) {
+      return false;
+    }
+
+    reset();
+
+    int n = s.header.n_nodes;
+    nodes.resize(n, blankNode());
+    for (int i=0; i < n; ++i) {
+      nodes[i].parent = s.parent[i];
+      nodes[i].children.assign(s.children.begin() + s.childrenBegin(i),
+                               s.children.begin() + s.childrenEnd(i));
+    }
+    free_list.assign(s.free_list.begin(), s.free_list.end());
+
+    rebuildLiveSlots();
+    indexAllChildPositions();
+    rebuildSubtreeInfo();
+    root = s.header.root;
+    return true;
+  }
+
+  bool writeBinary(const char *path) {
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+      return false;
+    }
+    bool ok = writeBinary(f);
+    return fclose(f) == 0 && ok;
+  }
+
+  bool readBinary(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+      return false;
+    }
+    bool ok = readBinary(f);
+    fclose(f);
+    return ok;
+  }
+
+#ifdef _GT_ENABLE_JOURNAL
+  // Journal
+  // -----------------------------
+  // While a journal is set, changes to the tree are recorded in it - see
+  // GenericTree_Journal.h. writeJournal() appends them to a file as a chunk,
+  // and clears the journal. replayJournal() applies each chunk in turn,
+  // returning false if one is malformed or doesn't match the tree, in which
+  // case the records before it have been applied. Compactions are replayed
+  // too, so external vectors should be saved in their compacted order.
+
+  void setJournal(GenericTree_Journal *j) {
+    journal = j;
+  }
+
+  bool writeJournal(FILE *f) {
+    _assert(journal);
+    bool ok = journal->writeChunk(f, 0);
+    if (ok) {
+      journal->clear();
+    }
+    return ok;
+  }
+
+  bool replayJournal(FILE *f) {
+    GenericTree_Journal *recording = journal;
+    journal = NULL;
+
+    GenericTree_JournalChunkHeader h;
+    std::vector<GenericTree_JournalRecord> records;
+    bool ok = true, at_end = false;
+
+    while (ok && GenericTree_Journal::readChunk(f, h, records, at_end)) {
+      ok = !(h.flags & GenericTree_Journal::HasPayloads);
+      for (size_t k=0; ok && k < records.size(); ++k) {
+        ok = replayRecord(records[k]);
+      }
+    }
+
+    journal = recording;
+    return ok && at_end;
+  }
+
+  bool writeJournal(const char *path) {
+    // Appends to the file at path
+    FILE *f = fopen(path, "ab");
+    if (!f) {
+      return false;
+    }
+    bool ok = writeJournal(f);
+    return fclose(f) == 0 && ok;
+  }
+
+  bool replayJournal(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+      return false;
+    }
+    bool ok = replayJournal(f);
+    fclose(f);
+    return ok;
+  }
+#endif
+
+#ifdef _GT_ENABLE_SERIALIZATION
+
+public:
+
+  // Serialization
+  // -----------------------------
+  // Only live nodes are written, so the output is proportional to the size of
+  // the tree rather than to the size of the nodes vector. Free slots are
+  // recreated on load from the free list.
+
+  Diatom toDiatom() {
+    Diatom d;
+
+    // Tree
+    {
+      d["tree"] = Diatom();
+
+      for (int i=0; i < nodes.size(); ++i) {
+        if (!slotIsLive(i)) {
+          continue;
+        }
+
+        Node &n = nodes[i];
+        Diatom &d_node = d["tree"][srlz_index(i)] = Diatom();
+
+        d_node["i"] = (double) i;
+        d_node["i__parent"] = (double) n.parent;
+        d_node["i__children"] = Diatom();
+        for (int j=0; j < n.children.size(); ++j) {
+          d_node["i__children"][srlz_index(j)] = (double) n.children[j];
+        }
+      }
+    }
 
     // Free list
+    {
+      d["free_list"] = Diatom();
+      for (int i=0; i < free_list.size(); ++i) {
+        d["free_list"][srlz_index(i)] = (double) free_list[i];
+      }
+    }
+
+    return d;
+  }
+
+  void fromDiatom(Diatom &d) {
+    _assert(d.is_table());
+    _assert(d["tree"].is_table());
+    _assert(d["free_list"].is_table());
+
+    reset();
+
+    // Free list
+    // - read first, so that records for free slots (which older files contain)
+    //   can be skipped
+    // - the nodes vector is sized to cover every free slot, since free slots
+    //   have no record of their own
+    std::vector<bool> is_free;
     d["free_list"].each([&](std::string &key, Diatom &f) {
       _assert(f.is_number());
-      free_list.push_back((int) f.number_value);
-
-      // NOTE: Suppose the free list contains an index beyond the 'used' portion
-      //  of the nodes vector. In this case after deserialization conceivably we could
-      //  crash when adding a node using that index.
-      //       However, this shouldn't be an issue since we serialize/deserialize the
-      //  entire nodes vector - even items that are on the free list. (Supposing we're
-      //  wrong in thinking it's impossible, an assert in addNode() checks for this.)
+      int i = (int) f.number_value;
+      free_list.push_back(i);
+
+      if (is_free.size() <= i) {
+        is_free.resize(i + 1, false);
+      }
+      is_free[i] = true;
     });
+    nodes.resize(is_free.size(), blankNode());
+
+    // Tree
+    d["tree"].each([&](std::string &key, Diatom &item) {
+      _assert(item["i"].is_number());
+      int i = (int) item["i"].number_value;
+      if (i < is_free.size() && is_free[i]) {
+        return;
+      }
+
+      Node n = blankNode();
+      bool ok = parseDiatomRecord(item, i, n);
+      _assert(ok);
+      if (nodes.size() <= i) {
+        nodes.resize(i + 1, blankNode());
+      }
+      nodes[i] = std::move(n);
+    });
+
+    diatomLoaded();
+  }
+
+  // Streaming loads
+  // -----------------------------
+  // readDiatomFile() loads a tree saved as text by Diatom-Storage, building it
+  // as the file is parsed rather than from a parsed document, so that the
+  // document is never held in memory. at is the path of the tree's table in
+  // the document (see GenericTree_DiatomStream.h).
+  //
+  // Returns false if the file can't be read, or is malformed, leaving the tree
+  // empty.
+  //
+  // readDiatomFileAsync() loads on a new thread, and calls done(bool ok) on that
+  // thread when finished. The tree must not be used until done is called. The
+  // thread is returned, to be joined or detached.
+
+  bool readDiatomFile(FILE *f, const char *at = "") {
+    reset();
+
+    // Records are kept in file order, and moved to their slots once the whole
+    // file is read, as a record's slot can only be checked against the number
+    // of records and free list entries
+    std::vector<int> slot_of;
+    bool ok = GenericTree_DiatomStream<Diatom>::read(f, at,
+      [&](Diatom &item) {
+        int i;
+        Node n = blankNode();
+        if (!parseDiatomRecord(item, i, n)) {
+          return false;
+        }
+        nodes.push_back(std::move(n));
+        slot_of.push_back(i);
+        return true;
+      },
+      [&](int i) {
+        free_list.push_back(i);
+        return i >= 0;
+      }
+    );
+
+    ok = ok && placeDiatomRecords(slot_of);
+    ok = ok && GenericTree_Binary::forestIsValid(
+      int(nodes.size()), -1, free_list.data(), int(free_list.size()),
+      [&](int i) { return nodes[i].parent; },
+      [&](int i) {
+        const ChildList &ch = nodes[i].children;
+        return std::make_pair(ch.data(), ch.data() + ch.size());
+      }
+    );
+    if (!ok) {
+      reset();
+      return false;
+    }
+
+    diatomLoaded();
+    return true;
+  }
+
+  bool readDiatomFile(const char *path, const char *at = "") {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+      reset();
+      return false;
+    }
+    bool ok = readDiatomFile(f, at);
+    fclose(f);
+    return ok;
+  }
+
+  template <class Done>
+  std::thread readDiatomFileAsync(const std::string &path, Done done, const std::string &at = "") {
+    return GenericTree_DiatomStream<Diatom>::async([this, path, at]() {
+      return readDiatomFile(path.c_str(), at.c_str());
+    }, done);
+  }
+
+protected:
+  bool parseDiatomRecord(Diatom &item, int &i, Node &n) {
+    // Read one node record: its slot, i, and its links, into n
+    if (!item["i"].is_number() || !item["i__parent"].is_number() || !item["i__children"].is_table()) {
+      return false;
+    }
+
+    typedef GenericTree_DiatomStream<Diatom> Stream;
+    if (!Stream::toIndex(item["i"].number_value, i) || i < 0 ||
+        !Stream::toIndex(item["i__parent"].number_value, n.parent)) {
+      return false;
+    }
+
+    bool ok = true;
+    item["i__children"].each([&](std::string &ch_key, Diatom &c) {
+      int j;
+      ok = ok && c.is_number() && Stream::toIndex(c.number_value, j);
+      if (ok) {
+        n.children.push_back(j);
+      }
+    });
+    return ok;
+  }
+
+  bool placeDiatomRecords(std::vector<int> &slot_of) {
+    // Move the records in nodes, in file order, to the slots in slot_of. Every
+    // slot must have a record or a free list entry, so there are at most as
+    // many slots as the two together. Records for free slots, which older
+    // files contain, are dropped.
+    int n_records = int(nodes.size());
+    int n_slots = 0;
+    for (auto i : slot_of)   { n_slots = std::max(n_slots, i + 1); }
+    for (auto i : free_list) { n_slots = std::max(n_slots, i + 1); }
+    if (n_slots > n_records + int(free_list.size())) {
+      return false;
+    }
+
+    // Each record's slot must be unique. The slots with no record take the
+    // blank nodes appended below, in order.
+    std::vector<uint8_t> has_record(n_slots, 0);
+    for (auto i : slot_of) {
+      if (has_record[i]) {
+        return false;
+      }
+      has_record[i] = 1;
+    }
+    slot_of.reserve(n_slots);
+    for (int i=0; i < n_slots; ++i) {
+      if (!has_record[i]) {
+        slot_of.push_back(i);
+      }
+    }
+
+    // Apply the permutation in place, one cycle at a time
+    nodes.resize(n_slots, blankNode());
+    for (int k=0; k < n_slots; ++k) {
+      while (slot_of[k] != k) {
+        int j = slot_of[k];
+        std::swap(nodes[k], nodes[j]);
+        std::swap(slot_of[k], slot_of[j]);
+      }
+    }
+
+    for (auto i : free_list) {
+      nodes[i] = blankNode();
+    }
+    return true;
+  }
+
+  void diatomLoaded() {
+    rebuildLiveSlots();
+    indexAllChildPositions();
+    rebuildSubtreeInfo();
+    root = findTopNode();
   }
 
 private:
@@ -0,0 +1,526 @@
+//
+// GenericTree_Parallel.h
+//
+// A small work-stealing task pool, used by the trees' parallel walks.
+//
+// - Each thread has its own task queue. A thread pushes and pops tasks at the back
+//   of its own queue, and when that is empty it steals from the front of another
+//   thread's, where the oldest (and so typically largest) tasks are
+// - Process functions are passed a Worker, through which they can spawn further
+//   tasks
+// - run() returns once every task, including those spawned while running, is done
+// - Tasks run on a GenericTree_ThreadPool, whose threads persist between runs and
+//   sleep while there is no work, and the calling thread takes part
+//
+// MIT licensed: http://opensource.org/licenses/MIT
+//
+
+#ifndef __GenericTree_Parallel_h
+#define __GenericTree_Parallel_h
+
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <memory>
+
+
+// GenericTree_ThreadPool
+// -----------------------------
+// A fixed set of threads which run a job together. run(job) calls job(w) once
+// on each of nThreads() threads, w being 0 for the calling thread and 1 up for
+// the pool's own, and returns when every call has. Between runs the pool's
+// threads sleep on a condition variable. A run started while the pool is busy
+// - from within a job, or from another thread - is given threads of its own,
+// started for that run.
+
+class GenericTree_ThreadPool {
+public:
+  explicit GenericTree_ThreadPool(int n_threads = 0) {
+    if (n_threads <= 0) {
+      n_threads = defaultThreadCount();
+    }
+    n = n_threads;
+    for (int w=1; w < n; ++w) {
+      threads.push_back(std::thread([this, w]() { threadLoop(w); }));
+    }
+  }
+
+  ~GenericTree_ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(m);
+      stopping = true;
+    }
+    cv_start.notify_all();
+    for (auto &t : threads) {
+      t.join();
+    }
+  }
+
+  GenericTree_ThreadPool(const GenericTree_ThreadPool &) = delete;
+  GenericTree_ThreadPool& operator=(const GenericTree_ThreadPool &) = delete;
+
+  static int defaultThreadCount() {
+    unsigned n = std::thread::hardware_concurrency();
+    return n > 0 ? int(n) : 1;
+  }
+
+  int nThreads() const {
+    return n;
+  }
+
+  void run(const std::function<void(int)> &job) {
+    std::unique_lock<std::mutex> run_lock(m_run, std::try_to_lock);
+    if (!run_lock.owns_lock()) {
+      GenericTree_ThreadPool(n).run(job);
+      return;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(m);
+      current = &job;
+      n_running = n - 1;
+      ++generation;
+    }
+    cv_start.notify_all();
+
+    job(0);
+
+    std::unique_lock<std::mutex> lock(m);
+    cv_done.wait(lock, [this]() { return n_running == 0; });
+    current = NULL;
+  }
+
+private:
+  int n;
+  std::vector<std::thread> threads;
+
+  std::mutex m_run;                 // Held while the pool's threads are running a job
+  std::mutex m;                     // Guards the fields below
+  std::condition_variable cv_start;
+  std::condition_variable cv_done;
+  const std::function<void(int)> *current = NULL;
+  unsigned long generation = 0;
+  int  n_running = 0;
+  bool stopping  = false;
+
+  void threadLoop(int w) {
+    unsigned long seen = 0;
+    std::unique_lock<std::mutex> lock(m);
+
+    while (true) {
+      cv_start.wait(lock, [&]() { return stopping || generation != seen; });
+      if (stopping) {
+        return;
+      }
+      seen = generation;
+
+      const std::function<void(int)> *job = current;
+      lock.unlock();
+      (*job)(w);
+      lock.lock();
+
+      if (--n_running == 0) {
+        cv_done.notify_one();
+      }
+    }
+  }
+};
+
+
+// GenericTree_ThreadPoolHandle
+// -----------------------------
+// How a tree holds its thread pool: created on first use, with n_threads
+// threads (0 for one per hardware thread). Copying a tree doesn't copy its
+// pool - the copy creates its own when it needs one.
+
+class GenericTree_ThreadPoolHandle {
+public:
+  GenericTree_ThreadPoolHandle() { }
+  GenericTree_ThreadPoolHandle(const GenericTree_ThreadPoolHandle &h) : n_threads(h.n_threads) { }
+  GenericTree_ThreadPoolHandle(GenericTree_ThreadPoolHandle &&h) : n_threads(h.n_threads), pool(std::move(h.pool)) { }
+
+  GenericTree_ThreadPoolHandle& operator=(const GenericTree_ThreadPoolHandle &h) {
+    if (this != &h) {
+      setThreadCount(h.n_threads);
+    }
+    return *this;
+  }
+  GenericTree_ThreadPoolHandle& operator=(GenericTree_ThreadPoolHandle &&h) {
+    if (this != &h) {
+      std::lock_guard<std::mutex> lock(m);
+      n_threads = h.n_threads;
+      pool = std::move(h.pool);
+    }
+    return *this;
+  }
+
+  void setThreadCount(int n) {
+    // Takes effect from the next run: the current pool's threads are stopped
+    std::lock_guard<std::mutex> lock(m);
+    if (n != n_threads) {
+      pool.reset();
+    }
+    n_threads = n;
+  }
+
+  GenericTree_ThreadPool& get() {
+    // Safe to call from several threads at once, as concurrent walks do
+    std::lock_guard<std::mutex> lock(m);
+    if (!pool) {
+      pool.reset(new GenericTree_ThreadPool(n_threads));
+    }
+    return *pool;
+  }
+
+private:
+  std::mutex m;
+  int n_threads = 0;
+  std::unique_ptr<GenericTree_ThreadPool> pool;
+};
+
+
+template <class Task>
+class GenericTree_TaskPool {
+public:
+  class Worker {
+  public:
+    void spawn(const Task &t) {
+      pool->pending.fetch_add(1);
+
+      Queue &q = pool->queues[index];
+      {
+        std::lock_guard<std::mutex> lock(q.m);
+        q.tasks.push_back(t);
+      }
+      pool->n_queued.fetch_add(1);
+      if (pool->n_idle.load() > 0) {
+        std::lock_guard<std::mutex> lock(pool->m_idle);
+        pool->cv_idle.notify_one();
+      }
+    }
+
+    int index;
+
+  private:
+    friend class GenericTree_TaskPool;
+    GenericTree_TaskPool *pool;
+  };
+
+  static int defaultThreadCount() {
+    return GenericTree_ThreadPool::defaultThreadCount();
+  }
+
+  template <class Process>
+  static void run(const Task &initial, Process process, GenericTree_ThreadPool &threads) {
+    // Run initial, and any tasks it spawns, on threads, calling
+    // process(Task&, Worker&)
+    GenericTree_TaskPool pool(threads.nThreads());
+    pool.execute(initial, process, threads);
+  }
+
+  template <class Process>
+  static void run(const Task &initial, Process process, int n_threads = 0) {
+    // As above, on n_threads threads started for this run (or one per hardware
+    // thread if n_threads is 0)
+    GenericTree_ThreadPool threads(n_threads);
+    run(initial, process, threads);
+  }
+
+private:
+  struct Queue {
+    std::mutex m;
+    std::deque<Task> tasks;
+  };
+
+  std::vector<Queue> queues;
+  std::atomic<long> pending;        // Tasks not yet finished
+  std::atomic<long> n_queued;       // Tasks in the queues
+  std::atomic<int>  n_idle;         // Workers waiting for tasks
+  std::mutex m_idle;
+  std::condition_variable cv_idle;
+
+  explicit GenericTree_TaskPool(int n_threads) :
+    queues(n_threads), pending(0), n_queued(0), n_idle(0) { }
+
+  template <class Process>
+  void execute(const Task &initial, Process &process, GenericTree_ThreadPool &threads) {
+    pending  = 1;
+    n_queued = 1;
+    queues[0].tasks.push_back(initial);
+
+    threads.run([this, &process](int w) { workerLoop(w, process); });
+  }
+
+  template <class Process>
+  void workerLoop(int w, Process &process) {
+    Worker worker;
+    worker.pool  = this;
+    worker.index = w;
+
+    Task t;
+    while (true) {
+      if (pop(w, t) || steal(w, t)) {
+        n_queued.fetch_sub(1);
+        process(t, worker);
+        if (pending.fetch_sub(1) == 1) {
+          std::lock_guard<std::mutex> lock(m_idle);
+          cv_idle.notify_all();
+        }
+        continue;
+      }
+
+      // Sleep until a task is queued or all are done. n_idle is raised before
+      // the queues are rechecked, so a spawn either sees a waiter to wake or
+      // its task is seen here.
+      std::unique_lock<std::mutex> lock(m_idle);
+      n_idle.fetch_add(1);
+      cv_idle.wait(lock, [this]() { return pending.load() == 0 || n_queued.load() > 0; });
+      n_idle.fetch_sub(1);
+      if (pending.load() == 0) {
+        return;
+      }
+    }
+  }
+
+  bool pop(int w, Task &t) {
+    Queue &q = queues[w];
+    std::lock_guard<std::mutex> lock(q.m);
+    if (q.tasks.empty()) {
+      return false;
+    }
+    t = q.tasks.back();
+    q.tasks.pop_back();
+    return true;
+  }
+
+  bool steal(int w, Task &t) {
+    for (int k=1, n = int(queues.size()); k < n; ++k) {
+      Queue &q = queues[(w + k) % n];
+      std::lock_guard<std::mutex> lock(q.m);
+      if (!q.tasks.empty()) {
+        t = q.tasks.front();
+        q.tasks.pop_front();
+        return true;
+      }
+    }
+    return false;
+  }
+};
+
+
+// GenericTree_ParallelWalk
+// -----------------------------
+// A pre-order walk whose subtrees are visited concurrently. Work is divided as
+// ranges of sibling indices: a task visits up to grain nodes depth-first, then
+// hands what remains of its ranges back to the pool, splitting each in two, so
+// that both deep and wide trees spread across threads. A subtree smaller than
+// grain is always walked by a single thread.
+//  - children_of(i):         node i's child indices (size() and operator[])
+//  - visit(i, depth, v):     called for each node, with the value returned by
+//                            visit for its parent; returns the value to pass
+//                            to its own children
+// A node is always visited after its parent, but nodes in different subtrees
+// are visited in no particular order, possibly at the same time.
+
+template <class Value>
+struct GenericTree_ParallelWalk {
+  struct Range {
+    int   parent;
+    int   next;
+    int   end;
+    int   depth;
+    Value v;
+  };
+  typedef GenericTree_TaskPool<Range> Pool;
+
+  template <class ChildrenOf, class Visit>
+  static void run(int i_start, const Value &v_in, int grain, GenericTree_ThreadPool &threads,
+                  ChildrenOf children_of, Visit visit) {
+    if (grain < 1) {
+      grain = 1;
+    }
+
+    Value v = visit(i_start, 0, v_in);
+    int n = int(children_of(i_start).size());
+    if (n == 0) {
+      return;
+    }
+
+    Pool::run(Range{ i_start, 0, n, 1, v }, [&](Range &task, typename Pool::Worker &w) {
+      std::vector<Range> stack;
+      stack.push_back(task);
+
+      for (int budget = grain; !stack.empty(); ) {
+        Range &r = stack.back();
+        if (r.next == r.end) {
+          stack.pop_back();
+          continue;
+        }
+
+        if (budget-- == 0) {
+          // Give back the remaining work, outermost (largest) ranges first, so
+          // they are at the front of this worker's queue, where thieves look
+          for (auto &s : stack) {
+            spawnSplit(s, w);
+          }
+          return;
+        }
+
+        int c     = children_of(r.parent)[r.next++];
+        int depth = r.depth;
+        Value v_c = visit(c, depth, r.v);
+
+        int n_c = int(children_of(c).size());
+        if (n_c > 0) {
+          stack.push_back(Range{ c, 0, n_c, depth + 1, v_c });
+        }
+      }
+    }, threads);
+  }
+
+private:
+  static void spawnSplit(const Range &s, typename Pool::Worker &w) {
+    if (s.next == s.end) {
+      return;
+    }
+    if (s.end - s.next == 1) {
+      w.spawn(s);
+      return;
+    }
+
+    int mid = s.next + (s.end - s.next) / 2;
+    w.spawn(Range{ s.parent, s.next, mid,   s.depth, s.v });
+    w.spawn(Range{ s.parent, mid,    s.end, s.depth, s.v });
+  }
+};
+
+
+// GenericTree_ParallelReduce
+// -----------------------------
+// A post-order walk whose subtrees are visited concurrently, for bottom-up
+// folds. The top of the tree is expanded breadth-first until there is a
+// frontier of enough subtrees to keep every thread busy. Ranges of frontier
+// subtrees are then walked on the pool, split in half whenever a task has
+// visited grain nodes, and finally the nodes above the frontier are visited
+// deepest first on the calling thread.
+//  - children_of(i):  node i's child indices (size() and operator[])
+//  - visit(i):        called for each node, after it has been called for all of
+//                     the node's children
+//  - scratch:         storage for the frontier and each worker's stack, kept
+//                     between calls. A run uses it only if no other run is:
+//                     concurrent or nested runs use storage of their own.
+
+struct GenericTree_ParallelReduce {
+  struct Range {
+    int begin;
+    int end;
+  };
+  struct Frame {
+    int i;
+    int next_child;
+  };
+  struct Scratch {
+    std::mutex in_use;                          // Held by the run using it
+    std::vector<int> queue;
+    std::vector<std::vector<Frame>> stacks;     // By worker index
+
+    // A copy is empty: the storage is only a cache
+    Scratch() { }
+    Scratch(const Scratch &) { }
+    Scratch& operator=(const Scratch &) { return *this; }
+  };
+  typedef GenericTree_TaskPool<Range> Pool;
+
+  template <class ChildrenOf, class Visit>
+  static void run(int i_start, int grain, GenericTree_ThreadPool &threads, Scratch &scratch,
+                  ChildrenOf children_of, Visit visit) {
+    if (grain < 1) {
+      grain = 1;
+    }
+    int n_threads = threads.nThreads();
+
+    std::unique_lock<std::mutex> lock(scratch.in_use, std::try_to_lock);
+    Scratch local;
+    Scratch &sc = lock.owns_lock() ? scratch : local;
+
+    std::vector<int> &queue = sc.queue;
+    queue.clear();
+
+    // Expand the top of the tree: queue[0, head) are the nodes above the
+    // frontier, in breadth-first order, and queue[head, end) the frontier
+    size_t head = 0;
+    size_t target = size_t(n_threads) * 16;
+    queue.push_back(i_start);
+    while (head < queue.size() && queue.size() - head < target) {
+      auto &&ch = children_of(queue[head++]);
+      for (int c = 0, n = int(ch.size()); c < n; ++c) {
+        queue.push_back(ch[c]);
+      }
+    }
+
+    int n_frontier = int(queue.size() - head);
+    if (n_frontier > 0) {
+      std::vector<std::vector<Frame>> &stacks = sc.stacks;
+      if (int(stacks.size()) < n_threads) {
+        stacks.resize(n_threads);
+      }
+      for (auto &st : stacks) {
+        st.clear();
+      }
+      const int *frontier = queue.data() + head;
+
+      Pool::run(Range{ 0, n_frontier }, [&](Range &task, typename Pool::Worker &w) {
+        std::vector<Frame> &stack = stacks[w.index];
+        int visited = 0;
+
+        for (int k = task.begin; k < task.end; ++k) {
+          if (visited >= grain && task.end - k > 1) {
+            int mid = k + (task.end - k) / 2;
+            w.spawn(Range{ mid, task.end });
+            task.end = mid;
+            visited = 0;
+          }
+          visited += reduceSubtree(frontier[k], stack, children_of, visit);
+        }
+      }, threads);
+    }
+
+    for (size_t k = head; k > 0; --k) {
+      visit(queue[k - 1]);
+    }
+  }
+
+private:
+  template <class ChildrenOf, class Visit>
+  static int reduceSubtree(int i, std::vector<Frame> &stack, ChildrenOf &children_of, Visit &visit) {
+    // Sequential post-order walk of the subtree at i. Returns the number of
+    // nodes visited.
+    int visited = 0;
+    stack.push_back(Frame{ i, 0 });
+
+    while (!stack.empty()) {
+      Frame &fr = stack.back();
+      auto &&ch = children_of(fr.i);
+
+      if (fr.next_child < int(ch.size())) {
+        int c = ch[fr.next_child++];
+        stack.push_back(Frame{ c, 0 });
+      }
+      else {
+        int j = fr.i;
+        stack.pop_back();
+        visit(j);
+        ++visited;
+      }
+    }
+
+    return visited;
+  }
+};
+
+
+#endif  // ifndef __GenericTree_Parallel_h
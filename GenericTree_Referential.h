@@ -17,15 +17,60 @@
 
 #include <vector>
 #include <cstdio>
+#include <cstdint>
+#include <algorithm>
+#include <type_traits>
+#include <utility>
+
+#include "GenericTree_Binary.h"
+#include "GenericTree_AncestorIndex.h"
 
 // Optionally enable serialization
 #ifdef _GTR_ENABLE_SERIALIZATION
   #include "Diatom.h"
+  #include "GenericTree_DiatomStream.h"
   #define _GTR_SZ(x) x
 #else
   #define _GTR_SZ(x)
 #endif
 
+// Optionally enable parallel walks
+#ifdef _GTR_ENABLE_PARALLEL
+  #include "GenericTree_Parallel.h"
+#endif
+
+// Optionally allocate node, child list and payload storage from an arena
+#ifdef _GTR_ENABLE_ARENA
+  #include "GenericTree_Arena.h"
+#endif
+
+// Optionally define _GTR_ENABLE_HANDLES for generational handles, which detect
+// an index whose node has since been removed, in O(1) (see Handle)
+
+// Optionally count work done on hot paths, returned by stats()
+#ifdef _GTR_ENABLE_STATS
+  #include "GenericTree_Stats.h"
+  #define _GTR_STAT(x) x
+#else
+  #define _GTR_STAT(x)
+#endif
+
+// Optionally record changes in a journal, for incremental saves
+#ifdef _GTR_ENABLE_JOURNAL
+  #include "GenericTree_Journal.h"
+  #define _GTR_JOURNAL(x) if (journal) { journal->x; }
+#else
+  #define _GTR_JOURNAL(x)
+#endif
+
+// Optionally define _GTR_ENABLE_SUBTREE_INFO to store each node's subtree
+// size and depth, for O(1) subtreeSize() and depth()
+
+// Optionally define _GTR_UNORDERED_CHILDREN to keep each node's position in
+// its parent's child list, so that removing a child takes O(1), by moving the
+// parent's last child into its place. Children are then not kept in insertion
+// order. (GenericTree_Linked removes children in O(1) and keeps their order.)
+
 // Optionally disable asserts
 #ifdef _GTR_DISABLE_SAFETY_CHECKS
   #define _assert(x)
@@ -40,23 +85,201 @@
 template <class T>
 class GenericTree_Referential {
 public:
+#ifdef _GTR_ENABLE_ARENA
+  typedef std::vector<int, GenericTree_ArenaAllocator<int>> ChildList;
+#else
+  typedef std::vector<int> ChildList;
+#endif
 
   struct NodeInfo {
-    T node;
+    // A node's topology. Payloads are stored separately, in a parallel vector,
+    // so that walks and structural queries don't pull them through the cache.
     int index_of_parent;
-    std::vector<int> children;
+    ChildList children;
+#ifdef _GTR_ENABLE_SUBTREE_INFO
+    int subtree_size;      // Nodes in the subtree at this node, itself included
+    int depth;             // 0 at the top of the tree, or of a detached subtree
+#endif
+#ifdef _GTR_UNORDERED_CHILDREN
+    int index_in_parent;   // Position in the parent's child list
+#endif
+    bool is_orphan;        // The parent was removed, so index_of_parent is stale
+
+    NodeInfo() : index_of_parent(__GTR_NOT_FOUND), is_orphan(false) { }
+    explicit NodeInfo(int parent) : index_of_parent(parent), is_orphan(false) { }
+  };
+
+#ifdef _GTR_ENABLE_ARENA
+  typedef std::vector<NodeInfo, GenericTree_ArenaAllocator<NodeInfo>> NodeList;
+  typedef std::vector<T, GenericTree_ArenaAllocator<T>> PayloadList;
+#else
+  typedef std::vector<NodeInfo> NodeList;
+  typedef std::vector<T> PayloadList;
+#endif
+
+  struct ChildSpan {
+    // A view of a node's child indices, valid until that node's children are
+    // next modified. Converts to std::vector<int> for callers that want a copy.
+    const int *first;
+    const int *last;
+
+    const int* begin() const { return first; }
+    const int* end()   const { return last; }
+    int  size()  const { return int(last - first); }
+    bool empty() const { return first == last; }
+    int  operator[](int k) const { return first[k]; }
+
+    operator std::vector<int>() const { return std::vector<int>(first, last); }
   };
 
   void reset() {
+#ifdef _GTR_ENABLE_HANDLES
+    retireAllSlots();
+#endif
+#ifdef _GTR_ENABLE_ARENA
+    // Release the storage, rather than clear(), so none is left in the arena
+    NodeList(GenericTree_ArenaAllocator<NodeInfo>(arena)).swap(nodes);
+    PayloadList(GenericTree_ArenaAllocator<T>(arena)).swap(payloads);
+#else
     nodes.clear();
+    payloads.clear();
+#endif
     free_list.clear();
+    live_slots.clear();
+    i_root = __GTR_NOT_FOUND;
+    ancestor_index_stale = true;
+    dirty_flags.clear();
+
+    batching = false;
+    batch_parents.clear();
+    batch_freed.clear();
+  }
+
+  void reserve(size_t n) {
+    nodes.reserve(n);
+    payloads.reserve(n);
+    live_slots.reserve((n + 63) >> 6);
+  }
+
+#ifdef _GTR_ENABLE_STATS
+  // Stats
+  // -----------------------------
+  // Counts of work done on hot paths since construction or the last
+  // resetStats() - see GenericTree_Stats.h. reset() doesn't clear them.
+
+  const GenericTree_Stats& stats() {
+    noteFreeListLength();
+    return stat_counts;
+  }
+
+  void resetStats() {
+    stat_counts = GenericTree_Stats();
+  }
+#endif
+
+#ifdef _GTR_ENABLE_ARENA
+  // Arena allocation
+  // -----------------------------
+  // With _GTR_ENABLE_ARENA defined, the nodes and payload vectors and the
+  // child lists are allocated from the arena set here (or from the heap if
+  // none is set), so that building a tree doesn't allocate per node. See
+  // GenericTree_Arena.h.
+  //  - setArena() resets the tree
+  //  - reset the tree before resetting its arena, as the arena's memory is
+  //    then reused
+
+  void setArena(GenericTree_Arena *_arena) {
+    arena = _arena;
+    reset();
+  }
+#endif
+
+  // Bulk construction
+  // -----------------------------
+  // Build the tree from n items and a matching array of parent indices, where
+  // parent[i] is the index of items[i]'s parent, or -1 for the root.
+  // Node i gets index i, and children are ordered by index.
+  //  - builds all child lists in two linear passes (count, then fill)
+  //  - fails, leaving the tree empty, unless there is exactly one root and every
+  //    node is reachable from it
+
+  bool buildFromParentArray(const T *items, const int *parent, size_t n) {
+    reset();
+    if (n == 0)
+      return true;
+
+    // Pass 1: validate parents & count children
+    std::vector<int> n_children(n, 0);
+    int i_top = __GTR_NOT_FOUND;
+
+    for (int i=0; i < int(n); ++i) {
+      int p = parent[i];
+      if (p == __GTR_NOT_FOUND) {
+        if (i_top != __GTR_NOT_FOUND) {
+          return false;    // More than one root
+        }
+        i_top = i;
+      }
+      else if (p < 0 || p >= int(n) || p == i) {
+        return false;
+      }
+      else {
+        ++n_children[p];
+      }
+    }
+    if (i_top == __GTR_NOT_FOUND) {
+      return false;
+    }
+
+    // Pass 2: fill
+    nodes.resize(n, blankNode());
+    payloads.assign(items, items + n);
+    for (int i=0; i < int(n); ++i) {
+      nodes[i].index_of_parent = parent[i];
+      nodes[i].children.reserve(n_children[i]);
+    }
+    for (int i=0; i < int(n); ++i) {
+      if (parent[i] != __GTR_NOT_FOUND)
+        nodes[parent[i]].children.push_back(i);
+    }
+
+    rebuildLiveSlots();
+    indexAllChildPositions();
+    rebuildSubtreeInfo();
+    i_root = i_top;
+
+    // Every node must be reachable from the root, otherwise the parent array
+    // contains a cycle
+    int n_reached = 0;
+    traversePreorder(i_top, [&](int i, int depth) { ++n_reached; });
+    if (n_reached != int(n)) {
+      reset();
+      return false;
+    }
+
+    return true;
+  }
+
+  static GenericTree_Referential<T> fromParentArray(const T *items, const int *parent, size_t n) {
+    GenericTree_Referential<T> t;
+    bool ok = t.buildFromParentArray(items, parent, n);
+    _assert(ok);
+    return t;
   }
 
-  int addNode(T x, int parent_ind = __GTR_NOT_FOUND) {
-    NodeInfo ni = { x, parent_ind };
+  int addNode(const T &x, int parent_ind = __GTR_NOT_FOUND) {
+    return emplaceNode(parent_ind, x);
+  }
 
-    bool was_empty = isEmpty();
+  int addNode(T &&x, int parent_ind = __GTR_NOT_FOUND) {
+    return emplaceNode(parent_ind, std::move(x));
+  }
 
+  template <class... Args>
+  int emplaceNode(int parent_ind, Args&&... args) {
+    // Add a node whose payload is constructed from args. A new slot's payload
+    // is constructed in place; a reused slot's is move-assigned from a
+    // temporary, and its child list keeps its storage.
 
     // Add the node to the nodes vector
 
@@ -65,38 +288,64 @@ public:
     if (free_list.size() > 0) {
       ind = free_list.back();
       free_list.pop_back();
+      _GTR_STAT(++stat_counts.free_list_reuses);
       _assert(ind < nodes.size());
-      nodes[ind] = ni;
+
+      NodeInfo &ni = nodes[ind];
+      ni.index_of_parent = parent_ind;
+      ni.is_orphan = false;
+      ni.children.clear();
+      payloads[ind] = T(std::forward<Args>(args)...);
     }
     else {
-      nodes.push_back(ni);
+      payloads.emplace_back(std::forward<Args>(args)...);
+      nodes.push_back(blankNode(parent_ind));
       ind = int(nodes.size()) - 1;
     }
+    setSlotLive(ind, true);
+    subtreeInfo_Add(ind, parent_ind, i_root);
+    ancestor_index_stale = true;
+    _GTR_JOURNAL(add(ind, parent_ind));
 
     // Add node to parent's children array
     if (parent_ind != __GTR_NOT_FOUND)
-      nodes[ni.index_of_parent].children.push_back(ind);
+      appendChild(parent_ind, ind);
 
     // If the node is being inserted at the top, deal with current
     // top node (if present)
-    else if (!was_empty) {
-      int i_top = indexOfTopNode();
-      if (i_top != __GTR_NOT_FOUND) {
-        nodes[ind].children.push_back(i_top);
-        nodes[i_top].index_of_parent = ind;
+    else {
+      if (i_root != __GTR_NOT_FOUND) {
+        appendChild(ind, i_root);
+        nodes[i_root].index_of_parent = ind;
+        dirtyAttach(i_root);
       }
+      i_root = ind;
     }
 
     return ind;
   }
 
   void removeNode(int i, bool recursivelyRemoveChildren) {
+    subtreeInfo_Detach(i);
+    if (!recursivelyRemoveChildren) {
+      subtreeInfo_Orphan(i);
+      orphanChildren(i);
+    }
+
     NodeInfo &node = nodes[i];
-    free_list.push_back(i);
+    freeSlot(i);
+    ancestor_index_stale = true;
+    _GTR_JOURNAL(remove(i, recursivelyRemoveChildren));
 
+    // An orphan's old parent slot may have been freed, or reused by a node
+    // which doesn't list it
     int i_parent = node.index_of_parent;
-    if (i_parent != __GTR_NOT_FOUND) {
-      removeChild_ForNodeAtIndex(i_parent, i);
+    if (isListedByParent(i)) {
+      if (batching) batch_parents.push_back(i_parent);
+      else          removeChild_ForNodeAtIndex(i_parent, i);
+    }
+    if (i == i_root) {
+      i_root = __GTR_NOT_FOUND;
     }
 
     if (recursivelyRemoveChildren) {
@@ -104,13 +353,90 @@ public:
     }
   }
 
+  bool moveSubtree(int i, int new_parent, int position = -1) {
+    // Make i the child of new_parent at position (after i is removed from its
+    // old parent), or its last child if -1, taking its subtree with it. Only
+    // the two child lists change, so the cost doesn't depend on the size of the
+    // subtree. Fails if new_parent is in i's subtree, or if i is the top node,
+    // as then new_parent could only be in an orphaned subtree.
+    _assert(i >= 0 && i < nodes.size() && slotIsLive(i));
+    _assert(new_parent >= 0 && new_parent < nodes.size() && slotIsLive(new_parent));
+    _assert(position == -1 || !batching);
+
+    if (i == i_root || subtreeContains(i, new_parent)) {
+      return false;
+    }
+
+    subtreeInfo_Detach(i);
+
+    // An orphan's old parent slot may have been freed, or reused by a node
+    // which doesn't list it
+    int old_parent = nodes[i].index_of_parent;
+    if (isListedByParent(i)) {
+      if (batching) batch_parents.push_back(old_parent);
+      else          removeChild_ForNodeAtIndex(old_parent, i);
+    }
+
+    insertChild(new_parent, i, position);
+    nodes[i].index_of_parent = new_parent;
+    subtreeInfo_Attach(i);
+    dirtyAttach(i);
+    ancestor_index_stale = true;
+    _GTR_JOURNAL(move(i, new_parent, position));
+    return true;
+  }
+
+  // Batches
+  // -----------------------------
+  // Between beginBatch() and commit(), removeNode() and moveSubtree() leave
+  // the node in its old parent's child list, only noting the parent as
+  // affected. commit() then filters each affected parent's list in a single
+  // pass, so removing or moving many children of a wide parent is linear
+  // rather than quadratic. Slots freed during a batch are only reused after
+  // commit(), and moves during a batch can only append (position -1).
+  //
+  // Until commit(), child lists may still contain nodes removed or moved away
+  // during the batch, so walks and child queries should wait for commit().
+
+  void beginBatch() {
+    _assert(!batching);
+    batching = true;
+    _GTR_JOURNAL(beginBatch());
+  }
+
+  void commit() {
+    _assert(batching);
+    _GTR_JOURNAL(commit());
+    batching = false;
+
+    std::sort(batch_parents.begin(), batch_parents.end());
+    batch_parents.erase(std::unique(batch_parents.begin(), batch_parents.end()), batch_parents.end());
+
+    if (batch_mark.size() < nodes.size()) {
+      batch_mark.resize(nodes.size(), 0);
+    }
+    for (auto p : batch_parents) {
+      filterChildren(p);
+      indexChildPositions(p);
+    }
+    batch_parents.clear();
+
+    free_list.insert(free_list.end(), batch_freed.begin(), batch_freed.end());
+    batch_freed.clear();
+    _GTR_STAT(noteFreeListLength());
+  }
+
+  bool isBatching() {
+    return batching;
+  }
+
   void print() {
     int i_top = indexOfTopNode();
     if (i_top == __GTR_NOT_FOUND) {
       printf("[Tree is empty]\n");
     }
     else {
-      walk([](T n, int i, int indent) {
+      walk([](const T &n, int i, int indent) {
         for (int i=0; i < indent; ++i) {
           if (i == indent - 1)
             printf("└──");
@@ -139,11 +465,28 @@ public:
     if (i == -2) i = indexOfTopNode();
     if (i == __GTR_NOT_FOUND) return;
 
-    f(nodes[i].node, i, indent);
+    traversePreorder(i, [&](int j, int depth) { f(payloads[j], j, indent + depth); });
+  }
+    // walk:           parents before children
+    // walk_postorder: children before parents
+    // walk_levelorder: breadth-first, level by level
+    // Functors are passed the stored payload, so can take it as T& or const T&
+    // to avoid copying it.
 
-    for (auto &i : nodes[i].children) {
-      walk(f, i, indent + 1);
-    }
+  template <class Functor>
+  void walk_postorder(Functor f, int i = -2, int indent = 0) {
+    if (i == -2) i = indexOfTopNode();
+    if (i == __GTR_NOT_FOUND) return;
+
+    traversePostorder(i, [&](int j, int depth) { f(payloads[j], j, indent + depth); });
+  }
+
+  template <class Functor>
+  void walk_levelorder(Functor f, int i = -2, int indent = 0) {
+    if (i == -2) i = indexOfTopNode();
+    if (i == __GTR_NOT_FOUND) return;
+
+    traverseLevelorder(i, [&](int j, int depth) { f(payloads[j], j, indent + depth); });
   }
 
   template <class Functor, class Return>
@@ -151,24 +494,202 @@ public:
     if (i == -2) i = indexOfTopNode();
     if (i == __GTR_NOT_FOUND) return;
 
-    Return r = f(nodes[i].node, r_parent, i);
-    for (auto &i : nodes[i].children)
-      walk_and_pass(f, r, i);
+    // In a pre-order walk, the most recently visited node at depth d-1 is the
+    // parent of the node being visited at depth d, so one stored return value
+    // per level is enough.
+    std::vector<Return> r_by_depth;
+
+    traversePreorder(i, [&](int j, int depth) {
+      const Return &r_in = depth == 0 ? r_parent : r_by_depth[depth - 1];
+      Return r = f(payloads[j], r_in, j);
+
+      if (depth < int(r_by_depth.size())) r_by_depth[depth] = r;
+      else                                r_by_depth.push_back(r);
+    });
   }
     // walk_and_pass:
     // Walk, passing the return value of the functor to all of the element's children.
 
-  int indexOfTopNode() {
-    if (isEmpty())
-      return __GTR_NOT_FOUND;
+  // Dirty walks
+  // -----------------------------
+  // markDirty(i) flags i as changed, and its ancestors as having a changed
+  // descendant, stopping at the first already flagged, so in O(depth) at
+  // most. The dirty walks then skip subtrees with nothing flagged, clearing
+  // flags as they go, so their cost follows the size of the change:
+  //  - walk_dirty visits the nodes marked dirty, in pre-order
+  //  - walk_and_pass_dirty visits each node marked dirty and its whole subtree,
+  //    whose inherited state depends on it, and that node's ancestors, whose
+  //    return values are passed down to it
+  // Moving a subtree holding flagged nodes, or adding a node above one, flags
+  // its new ancestors, so the walks still reach the flagged nodes. compact()
+  // keeps the flags, and nodes in orphaned subtrees are only reached by walks
+  // from them.
+
+  void markDirty(int i) {
+    _assert(i >= 0 && i < nodes.size() && slotIsLive(i));
+    if (dirty_flags.size() < nodes.size()) {
+      dirty_flags.resize(nodes.size(), 0);
+    }
 
-    int i_top = 0;
-    while (indexIsInFreeList(i_top))
-      ++i_top;
+    dirty_flags[i] |= DirtySelf;
+    for (int c = i; isListedByParent(c); c = nodes[c].index_of_parent) {
+      int p = nodes[c].index_of_parent;
+      if (dirty_flags[p] & DirtyBelow) {
+        break;
+      }
+      dirty_flags[p] |= DirtyBelow;
+    }
+  }
 
-    while (nodes[i_top].index_of_parent != __GTR_NOT_FOUND)
-      i_top = nodes[i_top].index_of_parent;
-    return i_top;
+  bool isDirty(int i) {
+    return dirtyFlags(i) & DirtySelf;
+  }
+
+  template <class Functor>
+  void walk_dirty(Functor f, int i = -2, int indent = 0) {
+    if (i == -2) i = indexOfTopNode();
+    if (i == __GTR_NOT_FOUND) return;
+
+    std::vector<WalkFrame> stack;
+    stack.swap(walkStack());
+    stack.push_back({ i, 0, 0 });
+
+    while (!stack.empty()) {
+      WalkFrame fr = stack.back();
+      stack.pop_back();
+
+      uint8_t flags = dirtyFlags(fr.i);
+      if (!flags) {
+        continue;
+      }
+      dirty_flags[fr.i] = 0;
+      if (flags & DirtySelf) {
+        f(payloads[fr.i], fr.i, indent + fr.depth);
+      }
+
+      if (flags & DirtyBelow) {
+        auto &children = nodes[fr.i].children;
+        for (int c = int(children.size()) - 1; c >= 0; --c) {
+          stack.push_back({ children[c], fr.depth + 1, 0 });
+        }
+      }
+    }
+
+    walkStack().swap(stack);
+  }
+
+  template <class Functor, class Return>
+  void walk_and_pass_dirty(Functor f, const Return &r_parent, int i = -2) {
+    if (i == -2) i = indexOfTopNode();
+    if (i == __GTR_NOT_FOUND) return;
+
+    // As in walk_and_pass, one stored return value per level is enough, since
+    // only visited nodes push their children. next_child marks frames inside
+    // the subtree of a dirty node, which are visited whatever their flags.
+    std::vector<Return> r_by_depth;
+    std::vector<WalkFrame> stack;
+    stack.swap(walkStack());
+    stack.push_back({ i, 0, 0 });
+
+    while (!stack.empty()) {
+      WalkFrame fr = stack.back();
+      stack.pop_back();
+
+      uint8_t flags = dirtyFlags(fr.i);
+      bool whole = fr.next_child || (flags & DirtySelf);
+      if (!whole && !(flags & DirtyBelow)) {
+        continue;
+      }
+      if (flags) {
+        dirty_flags[fr.i] = 0;
+      }
+
+      const Return &r_in = fr.depth == 0 ? r_parent : r_by_depth[fr.depth - 1];
+      Return r = f(payloads[fr.i], r_in, fr.i);
+      if (fr.depth < int(r_by_depth.size())) r_by_depth[fr.depth] = r;
+      else                                   r_by_depth.push_back(r);
+
+      auto &children = nodes[fr.i].children;
+      for (int c = int(children.size()) - 1; c >= 0; --c) {
+        stack.push_back({ children[c], fr.depth + 1, whole });
+      }
+    }
+
+    walkStack().swap(stack);
+  }
+
+  // Reduction
+  // -----------------------------
+  // Fold the subtree at i bottom-up, writing a value for each of its nodes into
+  // out, which is indexed by node index and so must have an entry for each
+  // index in the subtree:
+  //    out[j] = combineFn(...combineFn(leafFn(node_j, j), out[c0])..., out[cn])
+  // for j's children c0...cn, in order. Nothing else is allocated.
+  //  - leafFn(const T &node, int j) -> Value
+  //  - combineFn(const Value &acc, const Value &child) -> Value
+
+  template <class Value, class LeafFn, class CombineFn>
+  void reduce(Value *out, LeafFn leafFn, CombineFn combineFn, int i = -2) {
+    if (i == -2) i = indexOfTopNode();
+    if (i == __GTR_NOT_FOUND) return;
+
+    traversePostorder(i, [&](int j, int depth) { reduceNode(out, leafFn, combineFn, j); });
+  }
+
+#ifdef _GTR_ENABLE_PARALLEL
+  template <class Value, class LeafFn, class CombineFn>
+  void parallel_reduce(Value *out, LeafFn leafFn, CombineFn combineFn, int grain = 1024, int i = -2) {
+    // As reduce, evaluating separate subtrees concurrently (see
+    // GenericTree_Parallel.h). leafFn and combineFn must be safe to call
+    // from several threads at once.
+    if (i == -2) i = indexOfTopNode();
+    if (i == __GTR_NOT_FOUND) return;
+
+    GenericTree_ParallelReduce::run(i, grain, parallel_threads.get(), reduce_scratch,
+      [this](int j) -> const ChildList& { return nodes[j].children; },
+      [&](int j) { reduceNode(out, leafFn, combineFn, j); });
+  }
+
+  // Parallel walks
+  // -----------------------------
+  // As walk and walk_and_pass, but visiting separate subtrees concurrently on a
+  // work-stealing pool (see GenericTree_Parallel.h). Parents are still visited
+  // before their children. f is called from several threads at once, so must be
+  // safe to call concurrently for different nodes.
+  //  - grain: the number of nodes a thread visits before offering the rest of
+  //    its work to other threads. Smaller values balance better, larger ones
+  //    have less overhead.
+  //  - the tree must not be modified during the walk
+
+  template <class Functor>
+  void parallel_walk(Functor f, int grain = 1024, int i = -2, int indent = 0) {
+    if (i == -2) i = indexOfTopNode();
+    if (i == __GTR_NOT_FOUND) return;
+
+    GenericTree_ParallelWalk<char>::run(i, 0, grain, parallel_threads.get(),
+      [this](int j) -> const ChildList& { return nodes[j].children; },
+      [&](int j, int depth, char) -> char { f(payloads[j], j, indent + depth); return 0; });
+  }
+
+  template <class Functor, class Return>
+  void parallel_walk_and_pass(Functor f, const Return &r_parent, int grain = 1024, int i = -2) {
+    if (i == -2) i = indexOfTopNode();
+    if (i == __GTR_NOT_FOUND) return;
+
+    GenericTree_ParallelWalk<Return>::run(i, r_parent, grain, parallel_threads.get(),
+      [this](int j) -> const ChildList& { return nodes[j].children; },
+      [&f, this](int j, int depth, const Return &r) -> Return { return f(payloads[j], r, j); });
+  }
+
+  void setParallelThreads(int n) {
+    // The number of threads used by parallel walks; 0 for one per hardware thread.
+    // The threads are started by the next parallel walk, and kept for later ones.
+    parallel_threads.setThreadCount(n);
+  }
+#endif
+
+  int indexOfTopNode() {
+    return i_root;
   }
 
   int parentOfNode(int i) {
@@ -180,9 +701,10 @@ public:
     _assert(node_i < nodes.size());
     return (int) nodes[node_i].children.size();
   }
-  std::vector<int> children(int node_i) {
+  ChildSpan children(int node_i) {
     _assert(node_i < nodes.size());
-    return nodes[node_i].children;
+    const ChildList &ch = nodes[node_i].children;
+    return { ch.data(), ch.data() + ch.size() };
   }
 
   int childOfNode(int node_i, int child_i) {
@@ -191,136 +713,1314 @@ public:
     return nodes[node_i].children[child_i];
   }
 
-  T get(int i) {
+  T& get(int i) {
     _assert(i < nodes.size());
-    return nodes[i].node;
+    return payloads[i];
   }
 
-  bool isEmpty() {
-    return (nodes.size() == free_list.size());
+  const T& get(int i) const {
+    _assert(i < nodes.size());
+    return payloads[i];
   }
 
-protected:
-
-  std::vector<NodeInfo> nodes;
-  std::vector<int> free_list;
-
-  void removeChildren(int i) {
-    _assert(i < nodes.size());
+  // Payload storage
+  // -----------------------------
+  // Payloads are kept in one contiguous array, indexed by node index, so that
+  // loops over them can be vectorized. The array includes free slots, whose
+  // payloads are stale - skip them with slotIsFree().
 
-    for (auto &i : nodes[i].children) {
-      removeChildren(i);
-      free_list.push_back(i);
-    }
+  T* payloadData() {
+    return payloads.data();
   }
 
-  bool indexIsInFreeList(int ind) {
-    for (const auto &i : free_list)
-      if (i == ind) return true;
-    return false;
+  const T* payloadData() const {
+    return payloads.data();
   }
 
-  void removeChild_ForNodeAtIndex(int parent_ind, int child_ind) {
-    _assert(parent_ind < nodes.size());
-    _assert(child_ind < nodes.size());
-
-    NodeInfo &parent_node = nodes[parent_ind];
-    std::vector<int> &children = parent_node.children;
-    std::vector<int>::iterator it;
+  int nSlots() const {
+    return int(nodes.size());
+  }
 
-    for (it = children.begin(); it != children.end(); ++it) {
-      if (*it == child_ind)
-        break;
-    }
+  bool slotIsFree(int i) {
+    _assert(i >= 0 && i < nodes.size());
+    return !slotIsLive(i);
+  }
 
-    _assert(it != children.end());
-    children.erase(it);
+  bool isEmpty() {
+    return (nodes.size() == free_list.size());
   }
 
-_GTR_SZ(
+  // Levels
+  // -----------------------------
+  // levels() lists a subtree breadth-first, grouped by depth. Each level is a
+  // pair of parallel arrays, of node indices and of their parents' indices,
+  // so a per-level kernel can read its parents' results from the level above
+  // in one pass. Pass the same Levels back in to reuse its storage.
+  //
+  // After relayoutLevelOrder(), each level of the tree is a contiguous run of
+  // indices, so its nodes and payloads are also contiguous with no gathering:
+  // level d covers payloadData()[nodes[0] .. nodes[0] + size()).
+
+  struct LevelSpan {
+    const int *nodes;      // Node indices, in level order
+    const int *parents;    // The parent of each, or __GTR_NOT_FOUND at level 0
+    int n;
+
+    int  size()  const { return n; }
+    bool empty() const { return n == 0; }
+  };
 
-  /*** Serialization ***/
+  struct Levels {
+    std::vector<int> node;
+    std::vector<int> parent;
+    std::vector<int> level_start;    // Offset of each level in node & parent, then of their end
 
-  // In order to serialize, the nodes themselves must be serializable:
-  //    _toDiatom() and _fromDiatom() functions must be defined for the
-  //    node type, before GenericTree_Referential is #included.
+    int nLevels() const {
+      return level_start.empty() ? 0 : int(level_start.size()) - 1;
+    }
 
-public:
+    LevelSpan level(int d) const {
+      _assert(d >= 0 && d < nLevels());
+      int first = level_start[d];
+      return { node.data() + first, parent.data() + first, level_start[d+1] - first };
+    }
+  };
 
-  Diatom toDiatom() {
-    Diatom d;
+  void levels(Levels &out, int i = -2) {
+    if (i == -2) i = indexOfTopNode();
+    out.node.clear();
+    out.parent.clear();
+    out.level_start.clear();
+    if (i == __GTR_NOT_FOUND) return;
 
-    // Tree
-    {
-      d["tree"] = Diatom();
+    // Breadth-first, using the output as the queue
+    out.node.push_back(i);
+    out.parent.push_back(__GTR_NOT_FOUND);
+    out.level_start.push_back(0);
 
-      int i = 0;
-      for (auto n : nodes) {
-        Diatom &d_node = d["tree"][srlz_index(i++)] = Diatom();
+    size_t level_end = 1;
+    for (size_t head = 0; head < out.node.size(); ++head) {
+      if (head == level_end) {
+        out.level_start.push_back(int(head));
+        level_end = out.node.size();
+      }
 
-        d_node["node"] = _toDiatom(n.node);
-        d_node["parent_ind"] = (double) n.index_of_parent;
-        Diatom &dch = d_node["child_inds"] = Diatom();
-        int j = 0;
-        for (auto ind : n.children)
-          dch[srlz_index(j++)] = (double) ind;
+      int j = out.node[head];
+      for (auto c : nodes[j].children) {
+        out.node.push_back(c);
+        out.parent.push_back(j);
       }
     }
+    out.level_start.push_back(int(out.node.size()));
+  }
 
-    // Free list
-    {
-      d["free_list"] = Diatom();
-      int i = 0;
-      for (auto ind : free_list)
-        d["free_list"][srlz_index(i++)] = (double) ind;
-    }
+#ifdef _GTR_ENABLE_SUBTREE_INFO
+  // Subtree sizes & depths
+  // -----------------------------
+  // Kept up to date as the tree changes, so both are read in O(1):
+  //  - adding or removing a node updates its ancestors' sizes, in O(depth)
+  //  - adding a node at the top, or removing one non-recursively, also updates
+  //    depths, in O(size) of the subtrees affected
+  //  - the children of a node removed non-recursively become the tops of
+  //    detached subtrees, at depth 0, and are counted in no ancestor's size
+
+  int subtreeSize(int i) {
+    // Including i itself
+    _assert(i >= 0 && i < nodes.size() && slotIsLive(i));
+    return nodes[i].subtree_size;
+  }
 
-    return d;
+  int depth(int i) {
+    _assert(i >= 0 && i < nodes.size() && slotIsLive(i));
+    return nodes[i].depth;
   }
+#endif
 
-  void fromDiatom(Diatom &d) {
-    _assert(d.is_table());
-    reset();
+  // Ancestor index
+  // -----------------------------
+  // Numbers the nodes of the tree in pre-order (see GenericTree_AncestorIndex.h),
+  // so that these are O(1) rather than climbs or walks. The index is built by
+  // buildAncestorIndex(), or by the first query after the tree has changed:
+  // call it first when querying from several threads. Nodes of orphaned
+  // subtrees are not indexed, and are no node's ancestor.
+
+  void buildAncestorIndex() {
+    _assert(!batching);
+    ancestor_index.build(int(nodes.size()), i_root, [&](int i) -> const ChildList& {
+      return nodes[i].children;
+    });
+    ancestor_index_stale = false;
+  }
 
-    Diatom &d_tree      = d["tree"];
-    Diatom &d_free_list = d["free_list"];
-    _assert(d_tree.is_table());
-    _assert(d_free_list.is_table());
+  bool isAncestor(int a, int b) {
+    // Whether a is b, or one of b's ancestors
+    return ancestorIndex().isAncestor(a, b);
+  }
 
-    // Tree
-    d_tree.each([&](std::string &key, Diatom &dn) {
-      Diatom &d_node       = dn["node"];
-      Diatom &d_parent_ind = dn["parent_ind"];
-      Diatom &d_child_inds = dn["child_inds"];
+  int lowestCommonAncestor(int a, int b) {
+    // __GTR_NOT_FOUND unless both are in the tree
+    return ancestorIndex().lowestCommonAncestor(a, b);
+  }
 
-      _assert(d_parent_ind.is_number());
-      _assert(d_child_inds.is_table());
+  ChildSpan subtreeNodes(int i) {
+    // The nodes of the subtree at i, i first, in pre-order. Valid until the
+    // tree next changes.
+    auto r = ancestorIndex().subtree(i);
+    return { r.first, r.second };
+  }
 
-      typename GenericTree_Referential<T>::NodeInfo n;
-      n.node            = _fromDiatom(d_node);
-      n.index_of_parent = (int) d_parent_ind.number_value();
+  // Compaction
+  // -----------------------------
+  // compact() removes free slots and renumbers the live nodes in pre-order, so
+  // that walks sweep the nodes vector sequentially. Subtrees orphaned by
+  // non-recursive removal are kept, numbered after the main tree.
+  //
+  // relayoutLevelOrder() does the same, but numbers the nodes breadth-first,
+  // so that each level, and each node's children, are contiguous.
+  //
+  // Returns a table mapping each old index to its new one (or -1 for a slot that
+  // was free).
+
+  std::vector<int> compact() {
+    _assert(!batching);
+
+    std::vector<int> order;
+    collectLiveNodes(order, false);
+    _GTR_JOURNAL(compact());
+    return relayout(order);
+  }
 
-      d_child_inds.each([&](std::string &ch_key, Diatom &dc) {
-        _assert(dc.is_number());
-        n.children.push_back((int) dc.number_value());
-      });
+  std::vector<int> relayoutLevelOrder() {
+    _assert(!batching);
 
-      nodes.push_back(n);
-    });
+    std::vector<int> order;
+    collectLiveNodes(order, true);
+    _GTR_JOURNAL(relayoutLevelOrder());
+    return relayout(order);
+  }
 
-    // Free list
-    d_free_list.each([&](std::string, Diatom &li) {
-      _assert(li.is_number());
-      free_list.push_back((int) li.number_value());
+#ifdef _GTR_ENABLE_HANDLES
+  // Handles
+  // -----------------------------
+  // A node's index, with the generation of its slot when the handle was made.
+  // A slot's generation is incremented whenever its node is removed, so a
+  // handle kept across changes to the tree can be checked in O(1), and is never
+  // mistaken for a later node reusing the slot. compact() and reset()
+  // invalidate all handles.
+
+  struct Handle {
+    int      index;
+    uint32_t generation;
+  };
 
-      // NOTE: Suppose the free list contains an index beyond the 'used' portion
-      //  of the nodes vector. In this case after deserialization conceivably we could
-      //  crash when adding a node using that index.
+  Handle handle(int i) {
+    _assert(i >= 0 && i < nodes.size() && slotIsLive(i));
+    return { i, slotGeneration(i) };
+  }
+
+  bool isValid(Handle h) {
+    return slotIsLive(h.index) && slotGeneration(h.index) == h.generation;
+  }
+
+  int indexForHandle(Handle h) {
+    // The handle's node index, or __GTR_NOT_FOUND if the handle is no longer valid
+    return isValid(h) ? h.index : __GTR_NOT_FOUND;
+  }
+#endif
+
+protected:
+
+  NodeList nodes;
+  PayloadList payloads;                  // Indexed as nodes
+  std::vector<int> free_list;
+  int i_root = __GTR_NOT_FOUND;
+
+  GenericTree_AncestorIndex ancestor_index;
+  bool ancestor_index_stale = true;
+
+  enum { DirtySelf = 1, DirtyBelow = 2 };
+  std::vector<uint8_t> dirty_flags;    // Sized by markDirty()
+
+  uint8_t dirtyFlags(int i) {
+    return i < int(dirty_flags.size()) ? dirty_flags[i] : 0;
+  }
+
+  void dirtyAttach(int i) {
+    // i has been given a new parent. If anything in its subtree is flagged,
+    // flag all of its new ancestors, so the dirty walks reach it from the top.
+    if (!dirtyFlags(i)) {
+      return;
+    }
+    if (dirty_flags.size() < nodes.size()) {
+      dirty_flags.resize(nodes.size(), 0);
+    }
+    for (int c = i; isListedByParent(c); c = nodes[c].index_of_parent) {
+      dirty_flags[nodes[c].index_of_parent] |= DirtyBelow;
+    }
+  }
+
+  GenericTree_AncestorIndex& ancestorIndex() {
+    if (ancestor_index_stale) {
+      buildAncestorIndex();
+    }
+    return ancestor_index;
+  }
+
+#ifdef _GTR_ENABLE_ARENA
+  GenericTree_Arena *arena = NULL;
+#endif
+
+#ifdef _GTR_ENABLE_JOURNAL
+  GenericTree_Journal *journal = NULL;
+
+  bool replayRecord(const GenericTree_JournalRecord &r, T *payload) {
+    // Apply r, if it is valid for the tree as it is. payload is r's payload,
+    // for an Add or SetPayload record.
+    auto live = [&](int i) { return i >= 0 && i < int(nodes.size()) && slotIsLive(i); };
+
+    switch (r.op) {
+      case GenericTree_Journal::Add:
+        return (r.a == __GTR_NOT_FOUND || live(r.a)) && emplaceNode(r.a, std::move(*payload)) == r.i;
+      case GenericTree_Journal::Remove:
+        if (!live(r.i)) return false;
+        removeNode(r.i, r.a != 0);
+        return true;
+      case GenericTree_Journal::Move:
+        return live(r.i) && live(r.a) && r.b >= -1 && (r.b == -1 || !batching) &&
+               moveSubtree(r.i, r.a, r.b);
+      case GenericTree_Journal::SetPayload:
+        if (!live(r.i)) return false;
+        payloads[r.i] = std::move(*payload);
+        return true;
+      case GenericTree_Journal::BeginBatch:
+        if (batching) return false;
+        beginBatch();
+        return true;
+      case GenericTree_Journal::Commit:
+        if (!batching) return false;
+        commit();
+        return true;
+      case GenericTree_Journal::Compact:
+        if (batching) return false;
+        compact();
+        return true;
+      case GenericTree_Journal::RelayoutLevelOrder:
+        if (batching) return false;
+        relayoutLevelOrder();
+        return true;
+    }
+    return false;
+  }
+#endif
+
+#ifdef _GTR_ENABLE_STATS
+  GenericTree_Stats stat_counts;
+
+  void noteFreeListLength() {
+    if (free_list.size() > stat_counts.peak_free_list) {
+      stat_counts.peak_free_list = free_list.size();
+    }
+  }
+#endif
+
+  NodeInfo blankNode(int parent = __GTR_NOT_FOUND) {
+    NodeInfo node(parent);
+#ifdef _GTR_ENABLE_ARENA
+    node.children = ChildList(GenericTree_ArenaAllocator<int>(arena));
+#endif
+    return node;
+  }
+
+#ifdef _GTR_ENABLE_PARALLEL
+  GenericTree_ThreadPoolHandle parallel_threads;
+  GenericTree_ParallelReduce::Scratch reduce_scratch;
+#endif
+
+  int findTopNode() {
+    // Find the top node by climbing from the first live slot
+    if (isEmpty())
+      return __GTR_NOT_FOUND;
+
+    // Only parents which list their child are followed: an orphan's stale
+    // parent may since have been reused below it
+    int i_top = firstLiveSlot();
+    while (isListedByParent(i_top)) {
+      _GTR_STAT(++stat_counts.top_climbs);
+      i_top = nodes[i_top].index_of_parent;
+    }
+    return i_top;
+  }
+
+  void collectLiveNodes(std::vector<int> &order, bool level_order) {
+    // Live node indices in pre-order (or level order): the tree from the root,
+    // then any orphaned subtrees, each from its topmost live ancestor
+    std::vector<bool> seen(nodes.size(), false);
+    order.reserve(nodes.size() - free_list.size());
+
+    auto collect = [&](int i_top) {
+      auto visit = [&](int i, int depth) {
+        seen[i] = true;
+        order.push_back(i);
+      };
+      if (level_order) traverseLevelorder(i_top, visit);
+      else             traversePreorder(i_top, visit);
+    };
+
+    if (i_root != __GTR_NOT_FOUND) {
+      collect(i_root);
+    }
+    for (int i=0, n = int(nodes.size()); i < n; ++i) {
+      if (!slotIsLive(i) || seen[i]) {
+        continue;
+      }
+
+      int i_top = i;
+      while (true) {
+        int p = nodes[i_top].index_of_parent;
+        if (!isListedByParent(i_top) || seen[p]) {
+          break;
+        }
+        i_top = p;
+      }
+      collect(i_top);
+    }
+  }
+
+  std::vector<int> relayout(const std::vector<int> &order) {
+    // Rebuild the nodes vector with order[k] moved to index k. Every live node
+    // must appear in order exactly once. Parents are relinked from the child
+    // lists.
+    std::vector<int> remap(nodes.size(), __GTR_NOT_FOUND);
+    for (int k=0, n = int(order.size()); k < n; ++k)
+      remap[order[k]] = k;
+
+    std::vector<uint8_t> relaid_flags;
+    if (!dirty_flags.empty()) {
+      relaid_flags.resize(order.size(), 0);
+      for (int k=0, n = int(order.size()); k < n; ++k) {
+        relaid_flags[k] = dirtyFlags(order[k]);
+      }
+    }
+
+    NodeList relaid(order.size(), blankNode(), nodes.get_allocator());
+    PayloadList relaid_payloads(payloads.get_allocator());
+    relaid_payloads.reserve(order.size());
+    for (int k=0, n = int(order.size()); k < n; ++k) {
+      NodeInfo &node = relaid[k];
+      relaid_payloads.push_back(std::move(payloads[order[k]]));
+      node.children.swap(nodes[order[k]].children);
+      for (auto &c : node.children) {
+        c = remap[c];
+        relaid[c].index_of_parent = k;
+      }
+    }
+
+#ifdef _GTR_ENABLE_HANDLES
+    retireAllSlots();
+#endif
+    nodes.swap(relaid);
+    payloads.swap(relaid_payloads);
+    dirty_flags.swap(relaid_flags);
+    free_list.clear();
+    rebuildLiveSlots();
+    indexAllChildPositions();
+    rebuildSubtreeInfo();
+    i_root = i_root == __GTR_NOT_FOUND ? __GTR_NOT_FOUND : remap[i_root];
+    ancestor_index_stale = true;
+    _GTR_JOURNAL(remapPayloadSlots(remap));
+
+    return remap;
+  }
+
+  bool isListedByParent(int i) {
+    // Whether i's parent lists it as a child: false for the top of the tree,
+    // and for an orphan, whose parent slot may since have been freed or reused
+    return nodes[i].index_of_parent != __GTR_NOT_FOUND && !nodes[i].is_orphan;
+  }
+
+  void orphanChildren(int i) {
+    // i is being removed, leaving its children as the tops of detached subtrees
+    for (auto c : nodes[i].children) {
+      if (slotIsLive(c) && nodes[c].index_of_parent == i) {
+        nodes[c].is_orphan = true;
+      }
+    }
+  }
+
+  void indexOrphans() {
+    // Set is_orphan from the child lists, for a loaded tree: live nodes with a
+    // parent that doesn't list them are orphans
+    for (auto &n : nodes) {
+      n.is_orphan = n.index_of_parent != __GTR_NOT_FOUND;
+    }
+    for (int i=0, n = int(nodes.size()); i < n; ++i) {
+      if (slotIsLive(i)) {
+        for (auto c : nodes[i].children) {
+          if (nodes[c].index_of_parent == i) {
+            nodes[c].is_orphan = false;
+          }
+        }
+      }
+    }
+  }
+
+  bool nodeListsChild(int parent, int child) {
+#ifdef _GTR_UNORDERED_CHILDREN
+    // A listed child's index_in_parent is kept current
+    const ChildList &children = nodes[parent].children;
+    int k = nodes[child].index_in_parent;
+    return k >= 0 && k < int(children.size()) && children[k] == child;
+#else
+    for (auto c : nodes[parent].children) {
+      if (c == child) {
+        return true;
+      }
+    }
+    return false;
+#endif
+  }
+
+  void removeChildren(int i) {
+    _assert(i < nodes.size());
+
+    if (batching) {
+      removeChildren_Batched(i);
+      return;
+    }
+
+    // Free descendants children-first
+    traversePostorder(i, [&](int j, int depth) {
+      if (j != i) {
+        freeSlot(j);
+      }
+    });
+  }
+
+  void freeSlot(int i) {
+    setSlotLive(i, false);
+    if (i < int(dirty_flags.size())) {
+      dirty_flags[i] = 0;
+    }
+#ifdef _GTR_ENABLE_HANDLES
+    retireSlot(i);
+#endif
+    if (batching) batch_freed.push_back(i);
+    else          free_list.push_back(i);
+    _GTR_STAT(noteFreeListLength());
+  }
+
+  bool subtreeContains(int i, int j) {
+    // Whether j is i or one of its descendants. Uses the ancestor index if it is
+    // up to date, otherwise climbs at most nodes.size() steps, as the parents of
+    // orphaned nodes may be stale.
+    if (!ancestor_index_stale && ancestor_index.contains(i) && ancestor_index.contains(j)) {
+      return ancestor_index.isAncestor(i, j);
+    }
+    for (int k=0, n = (int) nodes.size(); j != __GTR_NOT_FOUND && k <= n; j = nodes[j].index_of_parent, ++k) {
+      if (j == i) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Batch state
+  bool batching = false;
+  std::vector<int>  batch_parents;    // Parents whose child lists need filtering
+  std::vector<int>  batch_freed;      // Slots to add to the free list on commit
+  std::vector<char> batch_mark;
+
+  void removeChildren_Batched(int i) {
+    // As removeChildren, but only descending into children still attached to
+    // their parent, skipping those removed or moved away earlier in the batch
+    std::vector<WalkFrame> stack;
+    stack.swap(walkStack());
+    stack.push_back({ i, 0, 0 });
+
+    while (!stack.empty()) {
+      WalkFrame &fr = stack.back();
+      auto &children = nodes[fr.i].children;
+
+      if (fr.next_child < int(children.size())) {
+        int c = children[fr.next_child++];
+        if (slotIsLive(c) && nodes[c].index_of_parent == fr.i) {
+          stack.push_back({ c, fr.depth + 1, 0 });
+        }
+      }
+      else {
+        int j = fr.i;
+        stack.pop_back();
+        if (j != i) {
+          freeSlot(j);
+        }
+      }
+    }
+
+    walkStack().swap(stack);
+  }
+
+  void filterChildren(int p) {
+    // Keep the children still attached to p. A node moved more than once
+    // within the batch can be listed several times: keep the last, as that is
+    // where it was most recently added.
+    auto &children = nodes[p].children;
+    int n = int(children.size());
+    int w = n;
+
+    for (int k = n - 1; k >= 0; --k) {
+      int c = children[k];
+      if (slotIsLive(c) && nodes[c].index_of_parent == p && !batch_mark[c]) {
+        batch_mark[c] = 1;
+        children[--w] = c;
+      }
+    }
+    children.erase(children.begin(), children.begin() + w);
+
+    for (auto c : children) {
+      batch_mark[c] = 0;
+    }
+  }
+
+  bool indexIsInFreeList(int ind) {
+    return !slotIsLive(ind);
+  }
+
+  // Slot liveness
+  // -----------------------------
+  // One bit per slot in the nodes vector, set while the slot is in use, i.e.
+  // not in the free list. Lets membership checks run in O(1), and scans for
+  // live slots skip 64 dead slots at a time.
+
+  std::vector<uint64_t> live_slots;
+
+  void setSlotLive(int i, bool live) {
+    size_t w = size_t(i) >> 6;
+    if (w >= live_slots.size())
+      live_slots.resize(w + 1, 0);
+    uint64_t bit = uint64_t(1) << (i & 63);
+    if (live) live_slots[w] |= bit;
+    else      live_slots[w] &= ~bit;
+  }
+
+  bool slotIsLive(int i) {
+    size_t w = size_t(i) >> 6;
+    return w < live_slots.size() && (live_slots[w] >> (i & 63)) & 1;
+  }
+
+  int firstLiveSlot() {
+    for (size_t w=0, n = live_slots.size(); w < n; ++w) {
+      _GTR_STAT(++stat_counts.live_slot_scans);
+      uint64_t bits = live_slots[w];
+      if (bits) {
+        int b = 0;
+        while (!(bits & 1)) { bits >>= 1; ++b; }
+        return int(w << 6) + b;
+      }
+    }
+    return -1;
+  }
+
+  void rebuildLiveSlots() {
+    live_slots.assign((nodes.size() + 63) >> 6, 0);
+    for (int i=0, n = int(nodes.size()); i < n; ++i)
+      setSlotLive(i, true);
+    for (auto i : free_list)
+      setSlotLive(i, false);
+  }
+
+#ifdef _GTR_ENABLE_HANDLES
+  // Slot generations
+  // -----------------------------
+  // Slots beyond the end of the vector are at generation 0
+
+  std::vector<uint32_t> generations;
+
+  uint32_t slotGeneration(int i) {
+    return size_t(i) < generations.size() ? generations[i] : 0;
+  }
+
+  void retireSlot(int i) {
+    if (size_t(i) >= generations.size()) {
+      generations.resize(i + 1, 0);
+    }
+    ++generations[i];
+  }
+
+  void retireAllSlots() {
+    // Move every slot past any generation handed out so far, for when nodes
+    // are renumbered or discarded wholesale
+    uint32_t g = 0;
+    for (auto x : generations) {
+      g = std::max(g, x);
+    }
+    generations.assign(std::max(generations.size(), nodes.size()), g + 1);
+  }
+#endif
+
+  template <class Value, class LeafFn, class CombineFn>
+  void reduceNode(Value *out, LeafFn &leafFn, CombineFn &combineFn, int j) {
+    // out[j] is written once, after all of j's children
+    Value v = leafFn(payloads[j], j);
+    for (auto c : nodes[j].children) {
+      v = combineFn(v, out[c]);
+    }
+    out[j] = v;
+  }
+
+  // Traversal
+  // -----------------------------
+  // Iterative traversal engines. These use an explicit stack rather than
+  // recursion, so arbitrarily deep trees can be walked without overflowing the
+  // thread stack. visit(i, depth) is called for each node in the subtree at i.
+  //
+  // The stack's storage is kept between walks, one per thread, so walks of a
+  // tree from several threads at once don't share it. A walk started from
+  // within a visitor swaps it out and uses its own, so nested walks are safe.
+
+  struct WalkFrame {
+    int i;
+    int depth;
+    int next_child;
+  };
+
+  static std::vector<WalkFrame>& walkStack() {
+    static thread_local std::vector<WalkFrame> stack;
+    return stack;
+  }
+
+  template <class Visitor>
+  void traversePreorder(int i_start, Visitor visit) {
+    std::vector<WalkFrame> stack;
+    stack.swap(walkStack());
+    stack.push_back({ i_start, 0, 0 });
+
+    while (!stack.empty()) {
+      WalkFrame fr = stack.back();
+      stack.pop_back();
+      visit(fr.i, fr.depth);
+
+      auto &children = nodes[fr.i].children;
+      for (int c = int(children.size()) - 1; c >= 0; --c) {
+        stack.push_back({ children[c], fr.depth + 1, 0 });
+      }
+    }
+
+    walkStack().swap(stack);
+  }
+
+  template <class Visitor>
+  void traversePostorder(int i_start, Visitor visit) {
+    std::vector<WalkFrame> stack;
+    stack.swap(walkStack());
+    stack.push_back({ i_start, 0, 0 });
+
+    while (!stack.empty()) {
+      WalkFrame &fr = stack.back();
+      auto &children = nodes[fr.i].children;
+
+      if (fr.next_child < int(children.size())) {
+        int c     = children[fr.next_child++];
+        int depth = fr.depth + 1;
+        stack.push_back({ c, depth, 0 });
+      }
+      else {
+        WalkFrame done = fr;
+        stack.pop_back();
+        visit(done.i, done.depth);
+      }
+    }
+
+    walkStack().swap(stack);
+  }
+
+  template <class Visitor>
+  void traverseLevelorder(int i_start, Visitor visit) {
+    std::vector<WalkFrame> queue;
+    queue.swap(walkStack());
+    queue.push_back({ i_start, 0, 0 });
+
+    for (size_t head = 0; head < queue.size(); ++head) {
+      WalkFrame fr = queue[head];
+      visit(fr.i, fr.depth);
+
+      for (auto c : nodes[fr.i].children) {
+        queue.push_back({ c, fr.depth + 1, 0 });
+      }
+    }
+
+    queue.clear();
+    walkStack().swap(queue);
+  }
+
+  void appendChild(int parent, int child) {
+    _GTR_STAT(stat_counts.child_reallocs += nodes[parent].children.size() == nodes[parent].children.capacity());
+    nodes[parent].children.push_back(child);
+    nodes[child].is_orphan = false;
+#ifdef _GTR_UNORDERED_CHILDREN
+    nodes[child].index_in_parent = int(nodes[parent].children.size()) - 1;
+#endif
+  }
+
+  void insertChild(int parent, int child, int position) {
+    // Insert child before the child at position, or append it if position is
+    // -1 or past the end
+    _assert(position >= -1);
+    auto &children = nodes[parent].children;
+    if (position == -1 || position >= int(children.size())) {
+      appendChild(parent, child);
+      return;
+    }
+
+    _GTR_STAT(stat_counts.child_reallocs += children.size() == children.capacity());
+    children.insert(children.begin() + position, child);
+    nodes[child].is_orphan = false;
+    indexChildPositions(parent);
+  }
+
+  void indexChildPositions(int parent) {
+#ifdef _GTR_UNORDERED_CHILDREN
+    auto &children = nodes[parent].children;
+    for (int k=0, n = int(children.size()); k < n; ++k) {
+      nodes[children[k]].index_in_parent = k;
+    }
+#endif
+  }
+
+  void indexAllChildPositions() {
+#ifdef _GTR_UNORDERED_CHILDREN
+    for (int i=0, n = int(nodes.size()); i < n; ++i) {
+      if (slotIsLive(i)) {
+        indexChildPositions(i);
+      }
+    }
+#endif
+  }
+
+  // Subtree info
+  // -----------------------------
+  // Called as nodes are added, removed, and moved, to maintain subtree sizes
+  // and depths. Empty unless _GTR_ENABLE_SUBTREE_INFO is defined.
+
+  void subtreeInfo_Add(int i, int parent, int i__prev_top) {
+    // i is being added under parent, or at the top if parent is __GTR_NOT_FOUND
+#ifdef _GTR_ENABLE_SUBTREE_INFO
+    NodeInfo &node = nodes[i];
+    node.subtree_size = 1;
+    if (parent != __GTR_NOT_FOUND) {
+      node.depth = nodes[parent].depth + 1;
+      addToAncestorSizes(parent, 1);
+    }
+    else {
+      node.depth = 0;
+      if (i__prev_top != __GTR_NOT_FOUND) {
+        node.subtree_size += nodes[i__prev_top].subtree_size;
+        refreshDepths(i__prev_top, 1);
+      }
+    }
+#endif
+  }
+
+  void subtreeInfo_Detach(int i) {
+    // i's subtree is being removed from its parent
+#ifdef _GTR_ENABLE_SUBTREE_INFO
+    if (nodes[i].depth > 0) {
+      addToAncestorSizes(nodes[i].index_of_parent, -nodes[i].subtree_size);
+    }
+#endif
+  }
+
+  void subtreeInfo_Attach(int i) {
+    // i's subtree has been made a child of its new parent. Depths within it only
+    // change if it moved to a different depth.
+#ifdef _GTR_ENABLE_SUBTREE_INFO
+    int parent = nodes[i].index_of_parent;
+    int depth  = nodes[parent].depth + 1;
+    if (nodes[i].depth != depth) {
+      refreshDepths(i, depth);
+    }
+    addToAncestorSizes(parent, nodes[i].subtree_size);
+#endif
+  }
+
+  void subtreeInfo_Orphan(int i) {
+    // i is being removed, leaving its children as the tops of detached subtrees
+#ifdef _GTR_ENABLE_SUBTREE_INFO
+    for (auto c : nodes[i].children) {
+      if (slotIsLive(c) && nodes[c].index_of_parent == i) {
+        refreshDepths(c, 0);
+      }
+    }
+#endif
+  }
+
+  void rebuildSubtreeInfo() {
+    // Recompute sizes and depths from the child lists. A live node is the top
+    // of a subtree if no live node lists it as a child.
+#ifdef _GTR_ENABLE_SUBTREE_INFO
+    int n = int(nodes.size());
+    std::vector<char> attached(n, 0);
+    for (int i=0; i < n; ++i) {
+      if (slotIsLive(i)) {
+        for (auto c : nodes[i].children) {
+          if (nodes[c].index_of_parent == i) {
+            attached[c] = 1;
+          }
+        }
+      }
+    }
+
+    std::vector<int> order;
+    for (int i=0; i < n; ++i) {
+      if (slotIsLive(i) && !attached[i]) {
+        traversePreorder(i, [&](int j, int depth) {
+          nodes[j].subtree_size = 1;
+          nodes[j].depth = depth;
+          order.push_back(j);
+        });
+      }
+    }
+    for (int k = int(order.size()) - 1; k >= 0; --k) {
+      NodeInfo &node = nodes[order[k]];
+      if (node.depth > 0) {
+        nodes[node.index_of_parent].subtree_size += node.subtree_size;
+      }
+    }
+#endif
+  }
+
+#ifdef _GTR_ENABLE_SUBTREE_INFO
+  void addToAncestorSizes(int i, int delta) {
+    // Add delta to the subtree sizes of i and each of its ancestors
+    while (true) {
+      nodes[i].subtree_size += delta;
+      if (nodes[i].depth == 0) {
+        break;
+      }
+      i = nodes[i].index_of_parent;
+    }
+  }
+
+  void refreshDepths(int i, int depth) {
+    // Set the depths in the subtree at i, with i at depth. Only descends into
+    // children still attached to their parent, since during a batch a child
+    // list can list nodes already moved away or removed.
+    std::vector<WalkFrame> stack;
+    stack.swap(walkStack());
+    stack.push_back({ i, depth, 0 });
+
+    while (!stack.empty()) {
+      WalkFrame fr = stack.back();
+      stack.pop_back();
+      nodes[fr.i].depth = fr.depth;
+
+      for (auto c : nodes[fr.i].children) {
+        if (slotIsLive(c) && nodes[c].index_of_parent == fr.i) {
+          stack.push_back({ c, fr.depth + 1, 0 });
+        }
+      }
+    }
+
+    walkStack().swap(stack);
+  }
+#endif
+
+  void removeChild_ForNodeAtIndex(int parent_ind, int child_ind) {
+    _assert(parent_ind < nodes.size());
+    _assert(child_ind < nodes.size());
+
+    NodeInfo &parent_node = nodes[parent_ind];
+    ChildList &children = parent_node.children;
+
+#ifdef _GTR_UNORDERED_CHILDREN
+    // Move the last child into the removed child's place
+    int k = nodes[child_ind].index_in_parent;
+    _assert(k >= 0 && k < int(children.size()) && children[k] == child_ind);
+    children[k] = children.back();
+    nodes[children[k]].index_in_parent = k;
+    children.pop_back();
+#else
+    typename ChildList::iterator it;
+
+    for (it = children.begin(); it != children.end(); ++it) {
+      if (*it == child_ind)
+        break;
+    }
+    _GTR_STAT(stat_counts.child_scan_steps += it - children.begin());
+
+    _assert(it != children.end());
+    children.erase(it);
+#endif
+  }
+
+public:
+
+  // Binary snapshots
+  // -----------------------------
+  // A compact alternative to the Diatom format - see GenericTree_Binary.h.
+  //
+  // Payloads are written by a codec with the methods:
+  //    bool write(FILE*, const T&)
+  //    bool read(FILE*, T&)
+  // The default, RawCodec, copies the bytes of T, so requires T to be trivially
+  // copyable.
+  //
+  // readBinary() returns false if the snapshot is truncated or malformed, leaving
+  // the tree unchanged.
+
+  struct RawCodec {
+    bool write(FILE *f, const T &x) {
+      static_assert(std::is_trivially_copyable<T>::value, "RawCodec requires a trivially copyable T");
+      return fwrite(&x, sizeof(T), 1, f) == 1;
+    }
+    bool read(FILE *f, T &x) {
+      static_assert(std::is_trivially_copyable<T>::value, "RawCodec requires a trivially copyable T");
+      return fread(&x, sizeof(T), 1, f) == 1;
+    }
+  };
+
+  template <class Codec = RawCodec>
+  bool writeBinary(FILE *f, Codec codec = Codec()) {
+    bool ok = GenericTree_Binary::writeStructure(
+      f, GenericTree_Binary::HasPayloads, int(nodes.size()), i_root, free_list,
+      [&](int i) { return slotIsLive(i); },
+      [&](int i) { return nodes[i].index_of_parent; },
+      [&](int i, std::vector<int32_t> &out) {
+        out.insert(out.end(), nodes[i].children.begin(), nodes[i].children.end());
+      }
+    );
+
+    for (int i=0, n = int(nodes.size()); ok && i < n; ++i) {
+      if (slotIsLive(i))
+        ok = codec.write(f, payloads[i]);
+    }
+    return ok;
+  }
+
+  template <class Codec = RawCodec>
+  bool readBinary(FILE *f, Codec codec = Codec()) {
+    GenericTree_BinaryStructure s;
+    if (!GenericTree_Binary::readStructure(f, s) ||
+        !(s.header.flags & GenericTree_Binary::HasPayloads) ||
+        (s.header.flags & GenericTree_Binary::HasChildPositions)) {
+      return false;
+    }
+
+    int n = s.header.n_nodes;
+    NodeList loaded(n, blankNode(), nodes.get_allocator());
+    PayloadList loaded_payloads(payloads.get_allocator());
+    loaded_payloads.resize(n);
+    for (int i=0; i < n; ++i) {
+      loaded[i].index_of_parent = s.parent[i];
+      loaded[i].children.assign(s.children.begin() + s.childrenBegin(i),
+                                s.children.begin() + s.childrenEnd(i));
+    }
+
+    // Payloads, for live slots
+    std::vector<bool> is_free(n, false);
+    for (auto i : s.free_list)
+      is_free[i] = true;
+    for (int i=0; i < n; ++i) {
+      if (!is_free[i] && !codec.read(f, loaded_payloads[i]))
+        return false;
+    }
+
+    reset();
+    nodes.swap(loaded);
+    payloads.swap(loaded_payloads);
+    free_list.assign(s.free_list.begin(), s.free_list.end());
+
+    rebuildLiveSlots();
+    indexOrphans();
+    indexAllChildPositions();
+    rebuildSubtreeInfo();
+    i_root = s.header.root;
+    return true;
+  }
+
+  template <class Codec = RawCodec>
+  bool writeBinary(const char *path, Codec codec = Codec()) {
+    FILE *f = fopen(path, "wb");
+    if (!f)
+      return false;
+    bool ok = writeBinary(f, codec);
+    return fclose(f) == 0 && ok;
+  }
+
+  template <class Codec = RawCodec>
+  bool readBinary(const char *path, Codec codec = Codec()) {
+    FILE *f = fopen(path, "rb");
+    if (!f)
+      return false;
+    bool ok = readBinary(f, codec);
+    fclose(f);
+    return ok;
+  }
+
+#ifdef _GTR_ENABLE_JOURNAL
+  // Journal
+  // -----------------------------
+  // While a journal is set, changes to the tree are recorded in it - see
+  // GenericTree_Journal.h. Changes to payloads in place aren't seen by the
+  // tree: record them with journalPayload(). writeJournal() appends the
+  // records to a file as a chunk, with payloads written by a codec as for
+  // writeBinary(), and clears the journal. replayJournal() applies each chunk
+  // in turn, returning false if one is malformed or doesn't match the tree,
+  // in which case the records before it have been applied.
+
+  void setJournal(GenericTree_Journal *j) {
+    journal = j;
+  }
+
+  void journalPayload(int i) {
+    // Record that node i's payload has changed
+    _assert(i >= 0 && i < nodes.size() && slotIsLive(i));
+    _GTR_JOURNAL(setPayload(i));
+  }
+
+  template <class Codec = RawCodec>
+  bool writeJournal(FILE *f, Codec codec = Codec()) {
+    _assert(journal);
+    bool ok = journal->writeChunk(f, GenericTree_Journal::HasPayloads);
+    for (auto i : journal->payloadSlots()) {
+      if (!ok) break;
+      ok = i >= 0 ? codec.write(f, payloads[i]) : codec.write(f, T());
+    }
+    if (ok) {
+      journal->clear();
+    }
+    return ok;
+  }
+
+  template <class Codec = RawCodec>
+  bool replayJournal(FILE *f, Codec codec = Codec()) {
+    GenericTree_Journal *recording = journal;
+    journal = NULL;
+
+    GenericTree_JournalChunkHeader h;
+    std::vector<GenericTree_JournalRecord> records;
+    std::vector<T> chunk_payloads;
+    bool ok = true, at_end = false;
+
+    while (ok && GenericTree_Journal::readChunk(f, h, records, at_end)) {
+      // Read the chunk's payloads before applying any of it
+      ok = (h.flags & GenericTree_Journal::HasPayloads) != 0;
+      chunk_payloads.clear();
+      for (size_t k=0; ok && k < records.size(); ++k) {
+        if (GenericTree_Journal::hasPayload(records[k])) {
+          chunk_payloads.emplace_back();
+          ok = codec.read(f, chunk_payloads.back());
+        }
+      }
+
+      size_t next_payload = 0;
+      for (size_t k=0; ok && k < records.size(); ++k) {
+        T *payload = GenericTree_Journal::hasPayload(records[k]) ? &chunk_payloads[next_payload++] : NULL;
+        ok = replayRecord(records[k], payload);
+      }
+    }
+
+    journal = recording;
+    return ok && at_end;
+  }
+
+  template <class Codec = RawCodec>
+  bool writeJournal(const char *path, Codec codec = Codec()) {
+    // Appends to the file at path
+    FILE *f = fopen(path, "ab");
+    if (!f)
+      return false;
+    bool ok = writeJournal(f, codec);
+    return fclose(f) == 0 && ok;
+  }
+
+  template <class Codec = RawCodec>
+  bool replayJournal(const char *path, Codec codec = Codec()) {
+    FILE *f = fopen(path, "rb");
+    if (!f)
+      return false;
+    bool ok = replayJournal(f, codec);
+    fclose(f);
+    return ok;
+  }
+#endif
+
+_GTR_SZ(
+
+  /*** Serialization ***/
+
+  // In order to serialize, the nodes themselves must be serializable:
+  //    _toDiatom() and _fromDiatom() functions must be defined for the
+  //    node type, before GenericTree_Referential is #included.
+
+public:
+
+  Diatom toDiatom() {
+    Diatom d;
+
+    // Tree
+    {
+      d["tree"] = Diatom();
+
+      for (int i=0, n_nodes = int(nodes.size()); i < n_nodes; ++i) {
+        const NodeInfo &n = nodes[i];
+        Diatom &d_node = d["tree"][srlz_index(i)] = Diatom();
+
+        d_node["node"] = _toDiatom(payloads[i]);
+        d_node["parent_ind"] = (double) n.index_of_parent;
+        Diatom &dch = d_node["child_inds"] = Diatom();
+        int j = 0;
+        for (auto ind : n.children)
+          dch[srlz_index(j++)] = (double) ind;
+      }
+    }
+
+    // Free list
+    {
+      d["free_list"] = Diatom();
+      int i = 0;
+      for (auto ind : free_list)
+        d["free_list"][srlz_index(i++)] = (double) ind;
+    }
+
+    return d;
+  }
+
+  void fromDiatom(Diatom &d) {
+    _assert(d.is_table());
+    reset();
+
+    Diatom &d_tree      = d["tree"];
+    Diatom &d_free_list = d["free_list"];
+    _assert(d_tree.is_table());
+    _assert(d_free_list.is_table());
+
+    // Tree
+    d_tree.each([&](std::string &key, Diatom &dn) {
+      bool ok = loadDiatomRecord(dn);
+      _assert(ok);
+    });
+
+    // Free list
+    d_free_list.each([&](std::string, Diatom &li) {
+      _assert(li.is_number());
+      free_list.push_back((int) li.number_value());
+
+      // NOTE: Suppose the free list contains an index beyond the 'used' portion
+      //  of the nodes vector. In this case after deserialization conceivably we could
+      //  crash when adding a node using that index.
       //       However, this shouldn't be an issue since we serialize/deserialize the
       //  entire nodes vector - even items that are on the free list. (Supposing we're
       //  wrong in thinking it's impossible, there is an assert in addNode() to catch this
       //  eventuality.)
     });
+
+    diatomLoaded();
+  }
+
+  // Streaming loads
+  // -----------------------------
+  // As for GenericTree_Nodeless: readDiatomFile() builds the tree as a file
+  // written by Diatom-Storage is parsed, without holding the document in
+  // memory. Each node's payload is passed to _fromDiatom() as its record is
+  // read. readDiatomFileAsync() loads on a new thread, calling done(bool ok)
+  // on that thread when finished.
+  //
+  // Returns false if the file can't be read, or is malformed, leaving the tree
+  // empty.
+
+  bool readDiatomFile(FILE *f, const char *at = "") {
+    reset();
+
+    bool ok = GenericTree_DiatomStream<Diatom>::read(f, at,
+      [&](Diatom &dn) { return loadDiatomRecord(dn); },
+      [&](int i) { free_list.push_back(i); return true; }
+    );
+
+    ok = ok && diatomRecordsAreValid();
+    if (!ok) {
+      reset();
+      return false;
+    }
+
+    diatomLoaded();
+    return true;
+  }
+
+  bool readDiatomFile(const char *path, const char *at = "") {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+      reset();
+      return false;
+    }
+    bool ok = readDiatomFile(f, at);
+    fclose(f);
+    return ok;
+  }
+
+  template <class Done>
+  std::thread readDiatomFileAsync(const std::string &path, Done done, const std::string &at = "") {
+    return GenericTree_DiatomStream<Diatom>::async([this, path, at]() {
+      return readDiatomFile(path.c_str(), at.c_str());
+    }, done);
+  }
+
+protected:
+  bool loadDiatomRecord(Diatom &dn) {
+    // Append the node record for the next slot
+    Diatom &d_node       = dn["node"];
+    Diatom &d_parent_ind = dn["parent_ind"];
+    Diatom &d_child_inds = dn["child_inds"];
+
+    typedef GenericTree_DiatomStream<Diatom> Stream;
+    int i_parent;
+    if (!d_parent_ind.is_number() || !d_child_inds.is_table() ||
+        !Stream::toIndex(d_parent_ind.number_value(), i_parent)) {
+      return false;
+    }
+
+    NodeInfo n = blankNode(i_parent);
+
+    bool ok = true;
+    d_child_inds.each([&](std::string &ch_key, Diatom &dc) {
+      int j;
+      ok = ok && dc.is_number() && Stream::toIndex(dc.number_value(), j);
+      if (ok) {
+        n.children.push_back(j);
+      }
+    });
+
+    nodes.push_back(std::move(n));
+    payloads.push_back(_fromDiatom(d_node));
+    return ok;
+  }
+
+  bool diatomRecordsAreValid() {
+    // Free slots' records hold the links they had when freed, which are
+    // cleared, as readBinary() would have them. The nodes must then pass the
+    // checks made of binary snapshots.
+    for (auto i : free_list) {
+      if (i >= 0 && i < int(nodes.size())) {
+        nodes[i].index_of_parent = -1;
+        nodes[i].children.clear();
+      }
+    }
+
+    return GenericTree_Binary::forestIsValid(
+      int(nodes.size()), -1, free_list.data(), int(free_list.size()),
+      [&](int i) { return nodes[i].index_of_parent; },
+      [&](int i) {
+        const ChildList &ch = nodes[i].children;
+        return std::make_pair(ch.data(), ch.data() + ch.size());
+      }
+    );
+  }
+
+  void diatomLoaded() {
+    rebuildLiveSlots();
+    indexOrphans();
+    indexAllChildPositions();
+    rebuildSubtreeInfo();
+    i_root = findTopNode();
   }
 
 private:
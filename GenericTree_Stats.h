@@ -0,0 +1,35 @@
+//
+// GenericTree_Stats.h
+//
+// Counters kept by the trees when _GT_ENABLE_STATS (GenericTree,
+// GenericTree_Nodeless) or _GTR_ENABLE_STATS (GenericTree_Referential) is
+// defined, and returned by their stats() methods.
+//
+// - A high child_scan_steps per removal suggests wide nodes, which
+//   _GT_UNORDERED_CHILDREN or GenericTree_Linked remove from in O(1)
+// - A peak_free_list that is large relative to the tree suggests calling
+//   compact()
+// - Without the macro nothing is counted, and the counters cost nothing
+//
+// MIT licensed: http://opensource.org/licenses/MIT
+//
+
+#ifndef __GenericTree_Stats_h
+#define __GenericTree_Stats_h
+
+#include <cstdint>
+
+
+struct GenericTree_Stats {
+  uint64_t free_list_reuses = 0;    // Nodes added in a slot taken from the free list
+  uint64_t peak_free_list   = 0;    // Longest the free list has been
+  uint64_t live_slot_scans  = 0;    // Words of the liveness bitmap read searching for a live slot
+  uint64_t index_lookups    = 0;    // indexOfNode() calls (GenericTree only)
+  uint64_t index_probes     = 0;    // Entries compared by those lookups
+  uint64_t child_reallocs   = 0;    // Children added which reallocated the parent's child list
+  uint64_t child_scan_steps = 0;    // Entries passed over finding a child to remove from its parent
+  uint64_t top_climbs       = 0;    // Parent links followed finding the top node
+};
+
+
+#endif  // ifndef __GenericTree_Stats_h
@@ -0,0 +1,160 @@
+//
+// Benchmark.h
+//
+// Shared harness for benchmark.cpp and benchmark_ref.cpp: tree shapes, command
+// line options, timing, and output.
+//
+// Results are written to stdout as CSV, one row per measurement:
+//    tree,shape,n,op,reps,seconds,ns_per_item
+//  - seconds:      total time over all reps
+//  - ns_per_item:  seconds / (reps * items), where items is the number of nodes
+//                  the op touches (or calls it makes, for indexOfTopNode)
+//
+// MIT licensed: http://opensource.org/licenses/MIT
+//
+
+#ifndef __GenericTree_Benchmark_h
+#define __GenericTree_Benchmark_h
+
+#include <vector>
+#include <string>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+
+namespace bench {
+
+// Options
+// -----------------------------
+//   --max-n N            largest tree size (default 1000000; sizes are powers of
+//                        10 from 1000)
+//   --max-serialize-n N  largest tree size for toDiatom/fromDiatom (default 10000)
+//   --shape NAME         only run this shape (may be repeated)
+
+struct Options {
+  int max_n = 1000000;
+  int max_serialize_n = 10000;
+  std::vector<std::string> shapes;
+};
+
+inline bool parseOptions(int argc, char **argv, Options &opt) {
+  for (int a=1; a < argc; ++a) {
+    bool has_value = a + 1 < argc;
+    if (has_value && !strcmp(argv[a], "--max-n")) {
+      opt.max_n = atoi(argv[++a]);
+    }
+    else if (has_value && !strcmp(argv[a], "--max-serialize-n")) {
+      opt.max_serialize_n = atoi(argv[++a]);
+    }
+    else if (has_value && !strcmp(argv[a], "--shape")) {
+      opt.shapes.push_back(argv[++a]);
+    }
+    else {
+      fprintf(stderr, "usage: %s [--max-n N] [--max-serialize-n N] [--shape kary|chain|star|random]...\n", argv[0]);
+      return false;
+    }
+  }
+  return true;
+}
+
+
+// Shapes
+// -----------------------------
+// Each shape is a parent array, with parent[i] < i, so that adding nodes in
+// index order always finds the parent already present. Node 0 is the root.
+//  - kary:    balanced, 4 children per node
+//  - chain:   each node the only child of the one before
+//  - star:    every node a child of the root
+//  - random:  each node's parent chosen uniformly from the nodes before it
+
+static const char *shape_names[] = { "kary", "chain", "star", "random" };
+
+inline std::vector<int> parentsForShape(const std::string &shape, int n) {
+  std::vector<int> parent(n);
+  std::mt19937 rng(12345);
+
+  for (int i=0; i < n; ++i) {
+    if (i == 0)                { parent[i] = -1; }
+    else if (shape == "kary")  { parent[i] = (i - 1) / 4; }
+    else if (shape == "chain") { parent[i] = i - 1; }
+    else if (shape == "star")  { parent[i] = 0; }
+    else                       { parent[i] = int(rng() % uint32_t(i)); }
+  }
+  return parent;
+}
+
+inline std::vector<int> nodesToRemove(int n, int count) {
+  // count distinct non-root nodes, in random order
+  std::vector<int> all;
+  for (int i=1; i < n; ++i) {
+    all.push_back(i);
+  }
+  std::mt19937 rng(54321);
+  std::shuffle(all.begin(), all.end(), rng);
+  all.resize(std::min(int(all.size()), count));
+  return all;
+}
+
+template <class Fn>
+void forEachCase(const Options &opt, Fn fn) {
+  // fn(shape, n, parent) for every selected shape and size
+  for (auto shape : shape_names) {
+    if (!opt.shapes.empty() &&
+        std::find(opt.shapes.begin(), opt.shapes.end(), shape) == opt.shapes.end()) {
+      continue;
+    }
+    for (long n = 1000; n <= opt.max_n; n *= 10) {
+      fn(shape, int(n), parentsForShape(shape, int(n)));
+    }
+  }
+}
+
+
+// Timing & output
+// -----------------------------
+
+static volatile long sink;    // Results are written here, so that the work isn't optimized away
+
+inline void clobber() {
+  // Stops the compiler from hoisting loop-invariant calls out of a timing loop
+#if defined(__GNUC__) || defined(__clang__)
+  asm volatile("" : : : "memory");
+#endif
+}
+
+inline int repsFor(int n) {
+  // Enough reps that each measurement covers about a million items
+  return std::max(1, 1000000 / n);
+}
+
+class Timer {
+public:
+  void start() { t0 = Clock::now(); }
+  void stop()  { total += std::chrono::duration<double>(Clock::now() - t0).count(); }
+  double seconds() const { return total; }
+
+private:
+  typedef std::chrono::steady_clock Clock;
+  Clock::time_point t0;
+  double total = 0;
+};
+
+inline void printHeader() {
+  printf("tree,shape,n,op,reps,seconds,ns_per_item\n");
+}
+
+inline void report(const char *tree, const char *shape, int n, const char *op,
+                   int reps, const Timer &t, long items) {
+  double ns = items > 0 ? t.seconds() * 1e9 / (double(reps) * items) : 0;
+  printf("%s,%s,%d,%s,%d,%.9f,%.2f\n", tree, shape, n, op, reps, t.seconds(), ns);
+  fflush(stdout);
+}
+
+}  // namespace bench
+
+
+#endif  // ifndef __GenericTree_Benchmark_h
@@ -0,0 +1,251 @@
+//
+// benchmark.cpp
+//
+// Times GenericTree and GenericTree_Nodeless across tree shapes and sizes. See
+// Benchmark.h for the options and output format, and benchmark_ref.cpp for
+// GenericTree_Referential.
+//
+
+#define _GT_ENABLE_SERIALIZATION
+
+#include "GenericTree.h"
+#include "GenericTree_Nodeless.h"
+#include "Benchmark.h"
+
+using bench::Timer;
+using bench::report;
+
+static const int RemoveCount = 256;    // Nodes removed one at a time, per rep
+
+
+void benchGenericTree(const bench::Options &opt, const char *shape, int n, const std::vector<int> &parent) {
+  const char *name = "GenericTree";
+  int reps = bench::repsFor(n);
+
+  std::vector<int>  items(n);
+  std::vector<int*> ptrs(n);
+  for (int i=0; i < n; ++i) {
+    ptrs[i] = &items[i];
+  }
+
+  auto build = [&](GenericTree<int> &t) {
+    t.addNode(items[0], NULL);
+    for (int i=1; i < n; ++i) {
+      t.addNode(items[i], &items[parent[i]]);
+    }
+  };
+
+  // Build
+  {
+    Timer tm;
+    for (int r=0; r < reps; ++r) {
+      GenericTree<int> t;
+      tm.start();
+      build(t);
+      tm.stop();
+    }
+    report(name, shape, n, "build", reps, tm, n);
+  }
+  {
+    Timer tm;
+    for (int r=0; r < reps; ++r) {
+      GenericTree<int> t;
+      tm.start();
+      t.buildFromParentArray(ptrs.data(), parent.data(), n);
+      tm.stop();
+    }
+    report(name, shape, n, "build_bulk", reps, tm, n);
+  }
+
+  // Queries
+  {
+    GenericTree<int> t;
+    build(t);
+
+    Timer tm;
+    tm.start();
+    for (int r=0; r < reps; ++r) {
+      long count = 0;
+      t.walk([&](int *x, int i) { count += i; });
+      bench::sink = count;
+    }
+    tm.stop();
+    report(name, shape, n, "walk", reps, tm, n);
+
+    const int n_calls = 1000000;
+    Timer tm_top;
+    tm_top.start();
+    long s = 0;
+    for (int k=0; k < n_calls; ++k) {
+      s += t.indexOfTopNode();
+      bench::clobber();
+    }
+    bench::sink = s;
+    tm_top.stop();
+    report(name, shape, n, "top", 1, tm_top, n_calls);
+  }
+
+  // Removal
+  {
+    std::vector<int> to_remove = bench::nodesToRemove(n, RemoveCount);
+    Timer tm_each, tm_subtree;
+    for (int r=0; r < reps; ++r) {
+      GenericTree<int> t;
+      build(t);
+      tm_each.start();
+      for (auto i : to_remove) {
+        t.removeNode(items[i], false);
+      }
+      tm_each.stop();
+
+      GenericTree<int> t2;
+      build(t2);
+      tm_subtree.start();
+      t2.removeNode(items[0], true);
+      tm_subtree.stop();
+    }
+    report(name, shape, n, "remove_each", reps, tm_each, long(to_remove.size()));
+    report(name, shape, n, "remove_subtree", reps, tm_subtree, n);
+  }
+
+  // Serialization
+  if (n <= opt.max_serialize_n) {
+    GenericTree<int> t;
+    build(t);
+
+    Timer tm_to, tm_from;
+    for (int r=0; r < reps; ++r) {
+      tm_to.start();
+      Diatom d = t.toDiatom(ptrs);
+      tm_to.stop();
+
+      GenericTree<int> t2;
+      tm_from.start();
+      t2.fromDiatom(d, ptrs);
+      tm_from.stop();
+    }
+    report(name, shape, n, "to_diatom", reps, tm_to, n);
+    report(name, shape, n, "from_diatom", reps, tm_from, n);
+  }
+}
+
+
+void benchNodeless(const bench::Options &opt, const char *shape, int n, const std::vector<int> &parent) {
+  const char *name = "GenericTree_Nodeless";
+  int reps = bench::repsFor(n);
+
+  auto build = [&](GenericTree_Nodeless &t) {
+    for (int i=0; i < n; ++i) {
+      t.addNode(parent[i]);
+    }
+  };
+
+  // Build
+  {
+    Timer tm;
+    for (int r=0; r < reps; ++r) {
+      GenericTree_Nodeless t;
+      tm.start();
+      build(t);
+      tm.stop();
+    }
+    report(name, shape, n, "build", reps, tm, n);
+  }
+  {
+    Timer tm;
+    for (int r=0; r < reps; ++r) {
+      GenericTree_Nodeless t;
+      tm.start();
+      t.buildFromParentArray(parent.data(), n);
+      tm.stop();
+    }
+    report(name, shape, n, "build_bulk", reps, tm, n);
+  }
+
+  // Queries
+  {
+    GenericTree_Nodeless t;
+    build(t);
+
+    Timer tm;
+    tm.start();
+    for (int r=0; r < reps; ++r) {
+      long count = 0;
+      t.walk([&](int i) { count += i; });
+      bench::sink = count;
+    }
+    tm.stop();
+    report(name, shape, n, "walk", reps, tm, n);
+
+    const int n_calls = 1000000;
+    Timer tm_top;
+    tm_top.start();
+    long s = 0;
+    for (int k=0; k < n_calls; ++k) {
+      s += t.indexOfTopNode();
+      bench::clobber();
+    }
+    bench::sink = s;
+    tm_top.stop();
+    report(name, shape, n, "top", 1, tm_top, n_calls);
+  }
+
+  // Removal
+  {
+    std::vector<int> to_remove = bench::nodesToRemove(n, RemoveCount);
+    Timer tm_each, tm_subtree;
+    for (int r=0; r < reps; ++r) {
+      GenericTree_Nodeless t;
+      build(t);
+      tm_each.start();
+      for (auto i : to_remove) {
+        t.removeNode(i, false);
+      }
+      tm_each.stop();
+
+      GenericTree_Nodeless t2;
+      build(t2);
+      tm_subtree.start();
+      t2.removeNode(0, true);
+      tm_subtree.stop();
+    }
+    report(name, shape, n, "remove_each", reps, tm_each, long(to_remove.size()));
+    report(name, shape, n, "remove_subtree", reps, tm_subtree, n);
+  }
+
+  // Serialization
+  if (n <= opt.max_serialize_n) {
+    GenericTree_Nodeless t;
+    build(t);
+
+    Timer tm_to, tm_from;
+    for (int r=0; r < reps; ++r) {
+      tm_to.start();
+      Diatom d = t.toDiatom();
+      tm_to.stop();
+
+      GenericTree_Nodeless t2;
+      tm_from.start();
+      t2.fromDiatom(d);
+      tm_from.stop();
+    }
+    report(name, shape, n, "to_diatom", reps, tm_to, n);
+    report(name, shape, n, "from_diatom", reps, tm_from, n);
+  }
+}
+
+
+int main(int argc, char **argv) {
+  bench::Options opt;
+  if (!bench::parseOptions(argc, argv, opt)) {
+    return 1;
+  }
+
+  bench::printHeader();
+  bench::forEachCase(opt, [&](const char *shape, int n, const std::vector<int> &parent) {
+    benchGenericTree(opt, shape, n, parent);
+    benchNodeless(opt, shape, n, parent);
+  });
+
+  return 0;
+}
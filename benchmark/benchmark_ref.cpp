@@ -0,0 +1,164 @@
+//
+// benchmark_ref.cpp
+//
+// Times GenericTree_Referential across tree shapes and sizes. See Benchmark.h
+// for the options and output format.
+//
+
+#define _GTR_ENABLE_SERIALIZATION
+
+#include "Diatom.h"
+
+Diatom _toDiatom(int x) {
+  Diatom d = (double)x;
+  return d;
+}
+int _fromDiatom(Diatom d) {
+  return d.number_value();
+}
+
+#include "GenericTree_Referential.h"
+#include "Benchmark.h"
+
+using bench::Timer;
+using bench::report;
+
+static const int RemoveCount = 256;    // Nodes removed one at a time, per rep
+
+
+void benchReferential(const bench::Options &opt, const char *shape, int n, const std::vector<int> &parent) {
+  const char *name = "GenericTree_Referential";
+  int reps = bench::repsFor(n);
+
+  std::vector<int> items(n);
+  for (int i=0; i < n; ++i) {
+    items[i] = i;
+  }
+
+  auto build = [&](GenericTree_Referential<int> &t) {
+    for (int i=0; i < n; ++i) {
+      t.addNode(items[i], parent[i]);
+    }
+  };
+
+  // Build
+  {
+    Timer tm;
+    for (int r=0; r < reps; ++r) {
+      GenericTree_Referential<int> t;
+      tm.start();
+      build(t);
+      tm.stop();
+    }
+    report(name, shape, n, "build", reps, tm, n);
+  }
+  {
+    Timer tm;
+    for (int r=0; r < reps; ++r) {
+      GenericTree_Referential<int> t;
+      tm.start();
+      t.buildFromParentArray(items.data(), parent.data(), n);
+      tm.stop();
+    }
+    report(name, shape, n, "build_bulk", reps, tm, n);
+  }
+
+  // Queries
+  {
+    GenericTree_Referential<int> t;
+    build(t);
+
+    Timer tm;
+    tm.start();
+    for (int r=0; r < reps; ++r) {
+      long count = 0;
+      t.walk([&](const int &x, int i, int indent) { count += x; });
+      bench::sink = count;
+    }
+    tm.stop();
+    report(name, shape, n, "walk", reps, tm, n);
+
+    Timer tm_pass;
+    tm_pass.start();
+    for (int r=0; r < reps; ++r) {
+      long count = 0;
+      t.walk_and_pass([&](const int &x, const int &depth, int i) {
+        count += depth;
+        return depth + 1;
+      }, 0);
+      bench::sink = count;
+    }
+    tm_pass.stop();
+    report(name, shape, n, "walk_and_pass", reps, tm_pass, n);
+
+    const int n_calls = 1000000;
+    Timer tm_top;
+    tm_top.start();
+    long s = 0;
+    for (int k=0; k < n_calls; ++k) {
+      s += t.indexOfTopNode();
+      bench::clobber();
+    }
+    bench::sink = s;
+    tm_top.stop();
+    report(name, shape, n, "top", 1, tm_top, n_calls);
+  }
+
+  // Removal
+  {
+    std::vector<int> to_remove = bench::nodesToRemove(n, RemoveCount);
+    Timer tm_each, tm_subtree;
+    for (int r=0; r < reps; ++r) {
+      GenericTree_Referential<int> t;
+      build(t);
+      tm_each.start();
+      for (auto i : to_remove) {
+        t.removeNode(i, false);
+      }
+      tm_each.stop();
+
+      GenericTree_Referential<int> t2;
+      build(t2);
+      tm_subtree.start();
+      t2.removeNode(0, true);
+      tm_subtree.stop();
+    }
+    report(name, shape, n, "remove_each", reps, tm_each, long(to_remove.size()));
+    report(name, shape, n, "remove_subtree", reps, tm_subtree, n);
+  }
+
+  // Serialization
+  if (n <= opt.max_serialize_n) {
+    GenericTree_Referential<int> t;
+    build(t);
+
+    Timer tm_to, tm_from;
+    for (int r=0; r < reps; ++r) {
+      tm_to.start();
+      Diatom d = t.toDiatom();
+      tm_to.stop();
+
+      GenericTree_Referential<int> t2;
+      tm_from.start();
+      t2.fromDiatom(d);
+      tm_from.stop();
+    }
+    report(name, shape, n, "to_diatom", reps, tm_to, n);
+    report(name, shape, n, "from_diatom", reps, tm_from, n);
+  }
+}
+
+
+int main(int argc, char **argv) {
+  bench::Options opt;
+  if (!bench::parseOptions(argc, argv, opt)) {
+    return 1;
+  }
+
+  bench::printHeader();
+  bench::forEachCase(opt, [&](const char *shape, int n, const std::vector<int> &parent) {
+    benchReferential(opt, shape, n, parent);
+  });
+
+  return 0;
+}
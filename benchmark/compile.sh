@@ -0,0 +1,22 @@
+clang++ -std=c++11 \
+   benchmark.cpp           \
+   ../../../Diatom/Diatom.cpp      \
+   ../../../Diatom/Diatom-Storage.cpp  \
+   -I ..                   \
+   -I ../../..             \
+   -I ../../../Diatom              \
+   -D_GT_DISABLE_SAFETY_CHECKS     \
+   -o gt_bench \
+   -O3
+
+clang++ -std=c++11 \
+   benchmark_ref.cpp           \
+   ../../../Diatom/Diatom.cpp      \
+   ../../../Diatom/Diatom-Storage.cpp  \
+   -I ..                   \
+   -I ../../../Diatom              \
+   -D_GTR_DISABLE_SAFETY_CHECKS    \
+   -o gt_bench_ref \
+   -O3
+
+# Usage: ./gt_bench [--max-n N] [--max-serialize-n N] [--shape NAME]... > results.csv
@@ -1,6 +1,7 @@
 #define _GTR_ENABLE_SERIALIZATION
 
 #include "Diatom-Storage.h"
+#include <cassert>
 
 Diatom _toDiatom(int x) {
   Diatom d = (double)x;
@@ -38,6 +39,22 @@ int main() {
   });
   printf("\n");
 
+  // Moving an orphaned subtree, after its old parent's slot has been reused
+
+  {
+    GenericTree_Referential<int> t;
+    int r = t.addNode(0);
+    int p = t.addNode(1, r);
+    int o = t.addNode(2, p);
+    t.removeNode(p, false);     // o is left as the top of an orphaned subtree
+    int q = t.addNode(9, r);    // Reuses p's slot
+    assert(q == p);
+
+    assert(t.moveSubtree(o, r));
+    assert(t.parentOfNode(o) == r);
+    assert(t.nChildren(q) == 0);
+  }
+
   return 0;
 }
 